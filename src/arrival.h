@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <algorithm>
+#include <cstdint>
+
+// Online estimate of the interval between updates from a device, used to
+// detect stale devices.  Like TCP's retransmission timer, it tracks a moving
+// average of the interval and of its deviation using integer arithmetic.  A
+// device is considered stale after missing a configurable number of updates,
+// but never later than a fixed upper bound.
+class ArrivalEstimator {
+public:
+    ArrivalEstimator() : mean(0), deviation(0), samples(0), skip(false) {}
+
+    void sample(unsigned long interval) {
+        if (skip) {
+            skip = false;
+            return;
+        }
+
+        const int32_t value = std::min(interval, max_interval);
+        if (!samples) {
+            mean = value;
+            deviation = value / 2;
+        } else {
+            const int32_t error = value - mean;
+            mean += error / 8;
+            deviation += (abs(error) - deviation) / 4;
+        }
+        if (samples < min_samples) {
+            ++samples;
+        }
+    }
+
+    unsigned long timeout(unsigned long upper_bound) const {
+        if (samples < min_samples) {
+            return upper_bound;
+        }
+        const unsigned long estimate =
+            missed_intervals * (unsigned long)mean + 4 * deviation;
+        return std::min(upper_bound, std::max(min_timeout, estimate));
+    }
+
+    unsigned long get_mean() const { return mean; }
+
+    // The next interval doesn't start at a known update, e.g. after restoring
+    // from a snapshot, so it's not sampled
+    void skip_next() { skip = true; }
+
+    static inline unsigned long missed_intervals = 3;
+
+    static constexpr uint8_t min_samples = 3;
+    static constexpr unsigned long min_timeout = 5 * 1000;
+    static constexpr unsigned long max_interval = 60 * 60 * 1000;
+
+protected:
+    int32_t mean;
+    int32_t deviation;
+    uint8_t samples;
+    bool skip;
+};
@@ -1,22 +1,28 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <ArduinoOTA.h>
-#include <ESP8266WebServer.h>
 #include <LittleFS.h>
 #include <PicoMQ.h>
 #include <PicoMQTT.h>
 #include <PicoSlugify.h>
 #include <PicoSyslog.h>
 #include <PicoUtils.h>
-#include <uri/UriRegex.h>
 
 #include <set>
 #include <string>
 #include <vector>
 
+#include "arrival.h"
+#include "celsius.h"
+#include "clock.h"
+#include "cluster.h"
 #include "hass.h"
+#include "http.h"
 #include "mqtt.h"
+#include "resolver.h"
 #include "schalter.h"
+#include "sensor.h"
+#include "snapshot.h"
 #include "zone.h"
 
 PicoSyslog::Logger syslog("calor");
@@ -28,13 +34,15 @@ PicoUtils::PinOutput heating_relay(D5, true);
 PicoUtils::PinOutput wifi_led(D4, true);
 PicoUtils::WiFiControlSmartConfig wifi_control(wifi_led);
 
-std::vector<Zone *> zones;
+std::vector<Zone> zones;
 
 std::vector<PicoUtils::Tickable *> tickables;
 
 String hostname = "Calor";
+std::vector<String> celsius_hosts;
+String syslog_host;
 
-PicoUtils::RestfulServer<ESP8266WebServer> server(80);
+HttpServer server(80);
 
 PicoMQ picomq;
 MQTTServer mqtt;
@@ -42,9 +50,9 @@ MQTTServer mqtt;
 const char CONFIG_FILE[] PROGMEM = "/config.json";
 
 Zone * find_zone_by_name(const String & name) {
-    for (auto zone_ptr : zones) {
-        if (name == zone_ptr->name) {
-            return zone_ptr;
+    for (auto & zone : zones) {
+        if (name == zone.name) {
+            return &zone;
         }
     }
     return nullptr;
@@ -54,23 +62,67 @@ JsonDocument get_config() {
     JsonDocument json;
 
     auto zone_config = json["zones"].to<JsonObject>();
-    for (const auto zone : zones) {
-        zone_config[zone->name] = zone->get_config();
+    for (const auto & zone : zones) {
+        zone_config[zone.name] = zone.get_config();
     }
 
     {
         auto hass = json["hass"];
-        hass["server"] = HomeAssistant::mqtt.host;
+        hass["server"] = HomeAssistant::broker;
         hass["port"] = HomeAssistant::mqtt.port;
         hass["username"] = HomeAssistant::mqtt.username;
         hass["password"] = HomeAssistant::mqtt.password;
     }
 
-    json["syslog"] = syslog.server;
+    json["syslog"] = syslog_host;
+    json["hostname"] = hostname;
+    json["stale_intervals"] = ArrivalEstimator::missed_intervals;
+    json["clock"] = Clock::get_config();
+
+    auto celsius = json["celsius"].to<JsonArray>();
+    for (const auto & host : celsius_hosts) {
+        celsius.add(host);
+    }
+
+    if (Cluster::enabled()) {
+        json["cluster"] = Cluster::get_config();
+    }
 
     return json;
 }
 
+// The relay is compared against the demand directly (rather than the last
+// demand), so that it also converges after being restored from a snapshot.
+// The boiler only runs if there's demand and at least one open valve, which
+// doesn't need to belong to a zone with demand.  This lets a zone whose valve
+// is still opening take over from one which is closing.
+void tick_boiler() {
+    bool demand = false;
+    bool flow = false;
+    for (const auto & zone : zones) {
+        demand = demand || zone.demand();
+        flow = flow || zone.flow();
+    }
+    demand = demand && flow;
+
+    // with multiple nodes, only the coordinator turns the boiler on
+    demand = Cluster::boiler_demand(demand);
+
+    if (demand != heating_relay.get()) {
+        syslog.printf("Turning boiler %s.\n", demand ? "on" : "off");
+        heating_relay.set(demand);
+    }
+}
+
+PicoUtils::PeriodicRun snapshot(5, Snapshot::save);
+
+// Keep the syslog server set to a resolved address, so that logging never
+// triggers a blocking lookup
+PicoUtils::PeriodicRun syslog_resolver(5, [] {
+    const IPAddress address = Resolver::resolve(syslog_host);
+    syslog.server = address.isSet() ? address.toString() : String();
+});
+
 bool healthy = false;
 
 PicoUtils::PeriodicRun healthcheck(5, [] {
@@ -80,34 +132,135 @@ PicoUtils::PeriodicRun healthcheck(5, [] {
         ((WiFi.status() == WL_CONNECTED) && HomeAssistant::healthcheck()) ||
         (millis() <= 30 * 1000);
 
-    for (const auto zone : zones) {
-        healthy = healthy && zone->healthcheck();
+    for (const auto & zone : zones) {
+        healthy = healthy && zone.healthcheck();
     }
 
+    // a slow client stalls message delivery to everyone else, but it would
+    // just reconnect after a reset, so it's only logged
+    mqtt.healthcheck();
+
     if (healthy) last_healthy.reset();
 
     if ((last_healthy.elapsed() >= 12 * 60 * 60) ||
         (mqtt.get_last_message_stopwatch().elapsed() >= 30 * 60)) {
         syslog.println(F("Healthcheck failing for too long.  Reset..."));
+        Snapshot::save();
         ESP.reset();
     }
 });
 
+// Handles PUT /config, the config is saved only if requested
+void put_config(bool save) {
+    JsonDocument config;
+    if (deserializeJson(config, server.body()) ||
+        !config["zones"].is<JsonObjectConst>()) {
+        server.send(400, "text/plain", "Invalid config");
+        return;
+    }
+
+    // changes are applied between control loop iterations, so there's no
+    // gap in control
+    load_zones(zones, config["zones"]);
+    HomeAssistant::update_zones();
+
+    {
+        const auto hass = config["hass"];
+        const String broker = hass["server"] | "";
+        const uint16_t port = hass["port"] | 1883;
+        const String username = hass["username"] | "";
+        const String password = hass["password"] | "";
+
+        if ((broker != HomeAssistant::broker) ||
+            (port != HomeAssistant::mqtt.port) ||
+            (username != HomeAssistant::mqtt.username) ||
+            (password != HomeAssistant::mqtt.password)) {
+            HomeAssistant::broker = broker;
+            HomeAssistant::mqtt.port = port;
+            HomeAssistant::mqtt.username = username;
+            HomeAssistant::mqtt.password = password;
+            HomeAssistant::mqtt.disconnect();
+        }
+    }
+
+    syslog_host = config["syslog"] | "";
+    ArrivalEstimator::missed_intervals = config["stale_intervals"] | 3;
+    Clock::init(config["clock"]);
+
+    // hostname, cluster and Celsius poller changes take effect after
+    // reboot
+    if (save) {
+        File file = LittleFS.open(FPSTR(CONFIG_FILE), "w");
+        if (!file) {
+            syslog.println(F("Error saving config."));
+        } else {
+            serializeJson(config, file);
+            file.close();
+        }
+    }
+
+    server.sendJson(get_config());
+}
+
 void setup_server() {
-    server.on("/zones", HTTP_GET, [] {
+    server.on("/zones", HttpServer::Method::get, [] {
         JsonDocument json;
 
-        for (const auto zone : zones) {
+        for (const auto & zone : zones) {
+            json[zone.name] = zone.get_status();
+        }
+
+        server.sendJson(json);
+    });
+
+    server.on("/zones", HttpServer::Method::patch, [] {
+        JsonDocument request;
+        if (deserializeJson(request, server.body()) ||
+            !request.is<JsonObjectConst>()) {
+            server.send(400, "text/plain", "Invalid JSON");
+            return;
+        }
+
+        // validate everything first, so that either all changes are applied
+        // or none of them
+        for (JsonPairConst kv : request.as<JsonObjectConst>()) {
+            if (!find_zone_by_name(kv.key().c_str())) {
+                server.send(404, "text/plain",
+                            String("Unknown zone: ") + kv.key().c_str());
+                return;
+            }
+
+            const char * error = Zone::validate_update(kv.value());
+            if (error) {
+                server.send(400, "text/plain",
+                            String(kv.key().c_str()) + ": " + error);
+                return;
+            }
+        }
+
+        // handlers run between control loop iterations, so all zones see the
+        // changes in the same iteration
+        JsonDocument json;
+        for (JsonPairConst kv : request.as<JsonObjectConst>()) {
+            Zone * zone = find_zone_by_name(kv.key().c_str());
+            zone->update(kv.value());
             json[zone->name] = zone->get_status();
         }
 
         server.sendJson(json);
     });
 
-    server.on("/config", HTTP_GET, [] { server.sendJson(get_config()); });
+    server.on("/config", HttpServer::Method::get,
+              [] { server.sendJson(get_config()); });
 
-    server.on(UriRegex("/zones/([^/]+)"), HTTP_GET, [] {
-        const String name = server.decodedPathArg(0).c_str();
+    server.on("/config", HttpServer::Method::put, [] { put_config(true); });
+
+    // applies a config until the next reboot, e.g. for tests
+    server.on("/config/volatile", HttpServer::Method::put,
+              [] { put_config(false); });
+
+    server.on("/zones/*", HttpServer::Method::get, [] {
+        const String name = server.decodedPathArg(0);
 
         Zone * zone = find_zone_by_name(name);
 
@@ -118,7 +271,19 @@ void setup_server() {
         }
     });
 
-    server.on("/uptime", HTTP_GET, [] {
+    server.on("/cluster", HttpServer::Method::get,
+              [] { server.sendJson(Cluster::get_status()); });
+
+    server.on("/clock", HttpServer::Method::get,
+              [] { server.sendJson(Clock::get_status()); });
+
+    server.on("/broker", HttpServer::Method::get,
+              [] { server.sendJson(mqtt.get_status()); });
+
+    server.on("/resolver", HttpServer::Method::get,
+              [] { server.sendJson(Resolver::get_status()); });
+
+    server.on("/uptime", HttpServer::Method::get, [] {
         unsigned long uptime = millis();
         server.send(200, "text/plain", String(uptime / 1000));
     });
@@ -155,21 +320,36 @@ void setup() {
         const auto config = PicoUtils::JsonConfigFile<JsonDocument>(
             LittleFS, FPSTR(CONFIG_FILE));
 
-        for (JsonPairConst kv : config["zones"].as<JsonObjectConst>()) {
-            Zone * zone = new Zone(kv.key().c_str(), kv.value());
-            zones.push_back(zone);
-            tickables.push_back(zone);
+        load_zones(zones, config["zones"]);
+
+        for (JsonVariantConst value : config["celsius"].as<JsonArrayConst>()) {
+            // entries are host names, optionally followed by a port
+            const String address = value.as<String>();
+            celsius_hosts.push_back(address);
+            const int colon = address.indexOf(':');
+            if (colon < 0) {
+                tickables.push_back(new CelsiusPoller(address));
+            } else {
+                tickables.push_back(
+                    new CelsiusPoller(address.substring(0, colon),
+                                      address.substring(colon + 1).toInt()));
+            }
         }
 
         {
             const auto hass = config["hass"];
-            HomeAssistant::mqtt.host = hass["server"] | "";
+            HomeAssistant::broker = hass["server"] | "";
             HomeAssistant::mqtt.port = hass["port"] | 1883;
             HomeAssistant::mqtt.username = hass["username"] | "";
             HomeAssistant::mqtt.password = hass["password"] | "";
         }
 
-        syslog.server = config["syslog"] | "";
+        Cluster::init(config["cluster"]);
+        Clock::init(config["clock"]);
+
+        ArrivalEstimator::missed_intervals = config["stale_intervals"] | 3;
+
+        syslog_host = config["syslog"] | "";
         hostname = config["hostname"] | "Calor";
     }
 
@@ -179,20 +359,8 @@ void setup() {
         return 1 + (HomeAssistant::connected() ? 1 : 0) + (healthy ? 1 : 0);
     };
 
-    tickables.push_back(new PicoUtils::Watch<bool>(
-        [] {
-            for (const auto zone : zones) {
-                if (zone->heat()) {
-                    return true;
-                }
-            }
-            return false;
-        },
-        [](bool demand) {
-            syslog.printf("Turning boiler %s.\n", demand ? "on" : "off");
-            heating_relay.set(demand);
-        }));
-
+    tickables.push_back(&snapshot);
+    tickables.push_back(&syslog_resolver);
     tickables.push_back(&healthcheck);
     tickables.push_back(&wifi_control);
 
@@ -203,15 +371,23 @@ void setup() {
 
     ArduinoOTA.setHostname(PicoSlugify::slugify(hostname).c_str());
     ArduinoOTA.begin();
+
+    if (Snapshot::restore()) {
+        syslog.println(F("Warm restart, control resumed from snapshot."));
+    }
 }
 
 void loop() {
     ArduinoOTA.handle();
-    server.handleClient();
+    server.loop();
     picomq.loop();
     mqtt.loop();
+    Resolver::tick();
+    tick_topology(zones);
+    tick_boiler();
     for (auto tickable : tickables) {
         tickable->tick();
     }
     HomeAssistant::tick();
+    Cluster::tick();
 }
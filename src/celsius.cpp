@@ -0,0 +1,255 @@
+#include "celsius.h"
+
+#include <ArduinoJson.h>
+#include <ESP8266WiFi.h>
+#include <PicoSyslog.h>
+
+#include "resolver.h"
+#include "sensor.h"
+
+extern PicoSyslog::Logger syslog;
+
+CelsiusPoller::CelsiusPoller(const String & host, uint16_t port)
+    : host(host),
+      port(port),
+      state(State::idle),
+      interval_ms(0),
+      failures(0),
+      status_code(0),
+      content_length(-1),
+      keep_alive(false) {}
+
+void CelsiusPoller::tick() {
+    if (state == State::idle) {
+        if ((stopwatch.elapsed_millis() >= interval_ms) &&
+            (WiFi.status() == WL_CONNECTED)) {
+            connect();
+        }
+        return;
+    }
+
+    if (state == State::connecting) {
+        if (client.connected()) {
+            send_request();
+        } else if (!client.connecting()) {
+            syslog.printf("Error connecting to Celsius %s.\n", host.c_str());
+            finish(false);
+        } else if (stopwatch.elapsed_millis() >= connect_timeout_ms) {
+            syslog.printf("Timeout connecting to Celsius %s.\n",
+                          host.c_str());
+            finish(false);
+        }
+        return;
+    }
+
+    receive();
+
+    if ((state != State::idle) &&
+        (stopwatch.elapsed_millis() >= response_timeout_ms)) {
+        syslog.printf("Celsius %s did not respond in time.\n", host.c_str());
+        finish(false);
+    }
+}
+
+void CelsiusPoller::connect() {
+    if (client.connected()) {
+        // kept alive since the last request
+        send_request();
+        return;
+    }
+
+    const IPAddress address = Resolver::resolve(host);
+    if (!address.isSet()) {
+        // try again on next tick, the lookup runs in the background
+        return;
+    }
+
+    // the previous connection, if any, is reset without waiting
+    if (!client.connect(address, port)) {
+        syslog.printf("Error connecting to Celsius %s.\n", host.c_str());
+        finish(false);
+        return;
+    }
+    client.set_no_delay(true);
+
+    state = State::connecting;
+    stopwatch.reset();
+}
+
+void CelsiusPoller::send_request() {
+    const String request = "GET /readings HTTP/1.1\r\nHost: " + host +
+                           "\r\nConnection: keep-alive\r\n\r\n";
+    if (!client.write(request.c_str(), request.length())) {
+        syslog.printf("Error sending request to Celsius %s.\n",
+                      host.c_str());
+        finish(false);
+        return;
+    }
+
+    state = State::status_line;
+    stopwatch.reset();
+    line = "";
+    body = "";
+    status_code = 0;
+    content_length = -1;
+    keep_alive = true;
+}
+
+void CelsiusPoller::receive() {
+    size_t budget = max_read_per_tick;
+
+    while (budget && (state != State::idle)) {
+        const size_t available = client.available();
+        if (!available) {
+            if (!client.connected()) {
+                // a body without Content-Length ends when the connection
+                // is closed
+                const bool complete =
+                    (state == State::body) && (content_length < 0);
+                keep_alive = false;
+                finish(complete);
+            }
+            return;
+        }
+
+        char buffer[64];
+        size_t size = std::min(sizeof(buffer), budget);
+        size = std::min(size, available);
+        if ((state == State::body) && (content_length >= 0)) {
+            size = std::min(size, (size_t)content_length - body.length());
+        }
+
+        const size_t read = client.read((uint8_t *)buffer, size);
+        if (!read) {
+            return;
+        }
+        budget -= read;
+
+        for (size_t i = 0; (i < read) && (state != State::idle); ++i) {
+            if (state == State::body) {
+                body.concat(buffer + i, read - i);
+                break;
+            }
+
+            if (buffer[i] == '\n') {
+                if (!process_line()) {
+                    finish(false);
+                    return;
+                }
+                line = "";
+            } else if (buffer[i] != '\r') {
+                line += buffer[i];
+            }
+        }
+
+        if (body.length() > max_body) {
+            syslog.printf("Response from Celsius %s too large.\n",
+                          host.c_str());
+            finish(false);
+            return;
+        }
+
+        if ((state == State::body) && (content_length >= 0) &&
+            (body.length() >= (size_t)content_length)) {
+            finish(true);
+            return;
+        }
+    }
+}
+
+bool CelsiusPoller::process_line() {
+    if (state == State::status_line) {
+        // HTTP/1.1 200 OK
+        const int space = line.indexOf(' ');
+        if (space < 0) {
+            return false;
+        }
+        status_code = line.substring(space + 1).toInt();
+        state = State::headers;
+        return true;
+    }
+
+    if (line.length()) {
+        const int colon = line.indexOf(':');
+        if (colon < 0) {
+            return false;
+        }
+
+        String name = line.substring(0, colon);
+        String value = line.substring(colon + 1);
+        name.toLowerCase();
+        value.trim();
+        value.toLowerCase();
+
+        if (name == "content-length") {
+            content_length = value.toInt();
+        } else if (name == "connection") {
+            keep_alive = (value != "close");
+        } else if (name == "transfer-encoding") {
+            // chunked responses are not supported
+            return false;
+        }
+        return true;
+    }
+
+    // end of headers
+    if (status_code != 200) {
+        syslog.printf("Celsius %s returned HTTP status %i.\n", host.c_str(),
+                      status_code);
+        return false;
+    }
+
+    if (content_length > (long)max_body) {
+        return false;
+    }
+
+    state = State::body;
+    return true;
+}
+
+void CelsiusPoller::finish(bool success) {
+    if (success) {
+        JsonDocument json;
+        if (deserializeJson(json, body) || !json.is<JsonObjectConst>()) {
+            syslog.printf("Invalid readings from Celsius %s.\n", host.c_str());
+            success = false;
+        } else {
+            for (JsonPairConst kv : json.as<JsonObjectConst>()) {
+                if (kv.value().is<double>()) {
+                    update_sensor(
+                        kv.key().c_str(),
+                        Temperature::from_double(kv.value().as<double>()));
+                }
+            }
+        }
+    }
+
+    if (success) {
+        // poll fast while readings change, slow down when they're stable
+        if (body != last_body) {
+            interval_ms = std::max(min_interval_ms, interval_ms / 2);
+        } else {
+            interval_ms = std::min(max_interval_ms,
+                                   std::max(min_interval_ms, interval_ms * 2));
+        }
+        last_body = body;
+        failures = 0;
+    } else {
+        failures = std::min(failures + 1, 16u);
+        interval_ms = std::min(max_backoff_ms, min_interval_ms << failures);
+        keep_alive = false;
+    }
+
+    if (!success) {
+        // never wait for a device which misbehaves, reset the connection
+        client.abort();
+    } else if (!keep_alive) {
+        // the response is complete, there's nothing left to flush
+        client.stop();
+    }
+
+    state = State::idle;
+    stopwatch.reset();
+    line = String();
+    body = String();
+}
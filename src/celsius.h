@@ -0,0 +1,58 @@
+#pragma once
+
+#include <Arduino.h>
+#include <PicoUtils.h>
+
+#include "tcp.h"
+
+// Periodically fetches all readings from a Celsius device over HTTP and feeds
+// them to the matching sensors.  The request is driven by a state machine, so
+// tick() never waits for the device, not even while connecting, and the
+// connection is kept open between polls.  The poll interval grows while
+// readings don't change and shrinks when they do.  Errors back off
+// exponentially.
+class CelsiusPoller : public PicoUtils::Tickable {
+public:
+    CelsiusPoller(const String & host, uint16_t port = 80);
+
+    void tick() override;
+
+    const String host;
+    const uint16_t port;
+
+    unsigned long min_interval_ms = 5 * 1000;
+    unsigned long max_interval_ms = 60 * 1000;
+    unsigned long max_backoff_ms = 5 * 60 * 1000;
+    unsigned long connect_timeout_ms = 2 * 1000;
+    unsigned long response_timeout_ms = 3 * 1000;
+    size_t max_body = 2048;
+    size_t max_read_per_tick = 512;
+
+protected:
+    enum class State {
+        idle,
+        connecting,
+        status_line,
+        headers,
+        body,
+    };
+
+    void connect();
+    void send_request();
+    void receive();
+    bool process_line();
+    void finish(bool success);
+
+    TcpClient client;
+    State state;
+    PicoUtils::Stopwatch stopwatch;
+    unsigned long interval_ms;
+    unsigned int failures;
+
+    String line;
+    String body;
+    String last_body;
+    int status_code;
+    long content_length;
+    bool keep_alive;
+};
@@ -0,0 +1,59 @@
+#include "clock.h"
+
+#include <PicoSyslog.h>
+#include <coredecls.h>
+
+extern PicoSyslog::Logger syslog;
+
+namespace Clock {
+
+namespace {
+
+// Anything before this is the epoch the clock starts from after boot
+const time_t min_valid_time = 1704067200;  // 2024-01-01
+
+String ntp_server;
+String tz;
+
+}  // namespace
+
+void init(const JsonVariantConst & config) {
+    ntp_server = config["ntp"] | "pool.ntp.org";
+    // POSIX TZ string, e.g. "CET-1CEST,M3.5.0,M10.5.0/3"
+    tz = config["timezone"] | "UTC0";
+
+    settimeofday_cb([] {
+        const time_t t = time(nullptr);
+        syslog.printf("Clock synchronized, local time: %s", ctime(&t));
+    });
+
+    configTime(tz.c_str(), ntp_server.c_str());
+}
+
+bool synced() { return time(nullptr) >= min_valid_time; }
+
+time_t now() { return time(nullptr); }
+
+JsonDocument get_status() {
+    JsonDocument json;
+    json["synced"] = synced();
+    if (synced()) {
+        const time_t t = now();
+        struct tm tm;
+        localtime_r(&t, &tm);
+        char buf[32];
+        strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+        json["time"] = t;
+        json["local"] = buf;
+    }
+    return json;
+}
+
+JsonDocument get_config() {
+    JsonDocument json;
+    json["ntp"] = ntp_server;
+    json["timezone"] = tz;
+    return json;
+}
+
+}  // namespace Clock
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include <ctime>
+
+// Wall clock, synchronized over NTP.  Until the first synchronization the time
+// is unknown and schedules are not applied.  After that, the clock keeps
+// running on the internal timer even if the NTP server becomes unreachable.
+namespace Clock {
+
+void init(const JsonVariantConst & config);
+
+bool synced();
+time_t now();
+
+JsonDocument get_status();
+JsonDocument get_config();
+
+};  // namespace Clock
@@ -0,0 +1,284 @@
+#include "cluster.h"
+
+#include <PicoSyslog.h>
+#include <PicoUtils.h>
+
+#include <vector>
+
+#include "hass.h"
+#include "zone.h"
+
+extern PicoSyslog::Logger syslog;
+extern std::vector<Zone> zones;
+extern String hostname;
+
+namespace Cluster {
+
+namespace {
+
+const unsigned long publish_interval_ms = 5 * 1000;
+const unsigned long peer_timeout_ms = 20 * 1000;
+
+struct Peer {
+    Peer(const String & name)
+        : name(name),
+          priority(-1),
+          listening(false),
+          demand(false),
+          zones(0),
+          heating(0) {}
+
+    const String name;
+    int priority;
+    bool listening;
+    bool demand;
+    size_t zones;
+    size_t heating;
+    String coordinator;
+    PicoUtils::Stopwatch last_seen;
+};
+
+String name;
+int priority = -1;
+std::vector<Peer> peers;
+
+bool local_demand = false;
+PicoUtils::TimedValue<bool> published_demand(false);
+String coordinator;
+String published_coordinator;
+bool published_listening = false;
+
+bool was_connected = false;
+PicoUtils::Stopwatch connected_since;
+
+bool is_alive(const Peer & peer) {
+    return peer.last_seen.elapsed_millis() < peer_timeout_ms;
+}
+
+// After connecting to the broker, a node listens to its peers for a publish
+// period before running for coordinator, as another node may be coordinating
+// already.
+bool is_listening() {
+    return HomeAssistant::connected() &&
+           (connected_since.elapsed_millis() < publish_interval_ms);
+}
+
+bool is_candidate() { return (priority >= 0) && !is_listening(); }
+
+// True if another node claimed the coordinator role recently
+bool peer_coordinating() {
+    for (const auto & peer : peers) {
+        if (is_alive(peer) && (peer.coordinator == peer.name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Candidates are ordered by priority, ties are broken by node name
+bool precedes(int priority_a, const String & name_a, int priority_b,
+              const String & name_b) {
+    return (priority_a < priority_b) ||
+           ((priority_a == priority_b) && (name_a < name_b));
+}
+
+void elect() {
+    String winner;
+    int winner_priority = -1;
+
+    // While disconnected from the broker we can't see anyone else, so we keep
+    // controlling our own zones.  If another node was coordinating, it's
+    // probably still running, so we wait until it would be considered gone.
+    if (HomeAssistant::connected() ? is_candidate() : !peer_coordinating()) {
+        winner = hostname;
+        winner_priority = priority;
+    }
+
+    if (HomeAssistant::connected()) {
+        for (const auto & peer : peers) {
+            if (!is_alive(peer) || peer.listening || (peer.priority < 0)) {
+                continue;
+            }
+            if (!winner.length() || precedes(peer.priority, peer.name,
+                                             winner_priority, winner)) {
+                winner = peer.name;
+                winner_priority = peer.priority;
+            }
+        }
+    }
+
+    // Take over only once the previous coordinator stepped down and no better
+    // candidate is about to join, so that two connected nodes never drive the
+    // boiler at the same time.  A coordinator keeps its role until a better
+    // candidate is done listening.
+    if (HomeAssistant::connected() && (winner == hostname) &&
+        (coordinator != hostname)) {
+        for (const auto & peer : peers) {
+            if (!is_alive(peer)) {
+                continue;
+            }
+            if ((peer.coordinator == peer.name) ||
+                (peer.listening && (peer.priority >= 0) &&
+                 precedes(peer.priority, peer.name, priority, hostname))) {
+                winner = "";
+                break;
+            }
+        }
+    }
+
+    if (winner != coordinator) {
+        syslog.printf("Cluster coordinator changing from '%s' to '%s'.\n",
+                      coordinator.c_str(), winner.c_str());
+        coordinator = winner;
+    }
+}
+
+void publish() {
+    size_t heating = 0;
+    for (const auto & zone : zones) {
+        heating += zone.heat() ? 1 : 0;
+    }
+
+    JsonDocument json;
+    json["demand"] = local_demand;
+    json["priority"] = priority;
+    json["listening"] = is_listening();
+    json["zones"] = zones.size();
+    json["heating"] = heating;
+    json["coordinator"] = coordinator;
+
+    String payload;
+    serializeJson(json, payload);
+    HomeAssistant::mqtt.publish("calor/" + name + "/" + hostname, payload);
+    published_demand = local_demand;
+    published_coordinator = coordinator;
+    published_listening = is_listening();
+}
+
+void on_summary(const char * topic, const String & payload) {
+    const String peer_name = String(topic).substring(name.length() + 7);
+    if (!peer_name.length() || peer_name == hostname) {
+        return;
+    }
+
+    JsonDocument json;
+    if (deserializeJson(json, payload)) {
+        syslog.printf("Invalid demand summary from Calor '%s'.\n",
+                      peer_name.c_str());
+        return;
+    }
+
+    Peer * peer = nullptr;
+    for (auto & p : peers) {
+        if (p.name == peer_name) {
+            peer = &p;
+            break;
+        }
+    }
+
+    if (!peer) {
+        syslog.printf("Calor '%s' joined the cluster.\n", peer_name.c_str());
+        peers.emplace_back(peer_name);
+        peer = &peers.back();
+    }
+
+    peer->priority = json["priority"] | -1;
+    peer->listening = json["listening"] | false;
+    peer->demand = json["demand"] | false;
+    peer->zones = json["zones"] | 0;
+    peer->heating = json["heating"] | 0;
+    peer->coordinator = json["coordinator"] | "";
+    peer->last_seen.reset();
+}
+
+}  // namespace
+
+void init(const JsonVariantConst & config) {
+    name = config["name"] | "";
+    priority = config["priority"] | 0;
+
+    if (!enabled()) {
+        return;
+    }
+
+    HomeAssistant::mqtt.subscribe(
+        "calor/" + name + "/+",
+        [](const char * topic, const String & payload) {
+            on_summary(topic, payload);
+        });
+}
+
+bool enabled() { return name.length() > 0; }
+
+void tick() {
+    if (!enabled()) {
+        return;
+    }
+
+    const bool connected = HomeAssistant::connected();
+    if (connected && !was_connected) {
+        connected_since.reset();
+    }
+    was_connected = connected;
+
+    elect();
+
+    if ((published_demand.elapsed_millis() >= publish_interval_ms) ||
+        (published_demand != local_demand) ||
+        (published_coordinator != coordinator) ||
+        (published_listening != is_listening())) {
+        publish();
+    }
+}
+
+bool boiler_demand(bool demand) {
+    local_demand = demand;
+
+    if (!enabled()) {
+        return demand;
+    }
+
+    if (coordinator != hostname) {
+        return false;
+    }
+
+    for (const auto & peer : peers) {
+        if (is_alive(peer) && peer.demand) {
+            return true;
+        }
+    }
+
+    return demand;
+}
+
+JsonDocument get_status() {
+    JsonDocument json;
+
+    json["coordinator"] = coordinator;
+    json["demand"] = local_demand;
+
+    auto nodes = json["peers"].to<JsonObject>();
+    for (const auto & peer : peers) {
+        auto node = nodes[peer.name].to<JsonObject>();
+        node["alive"] = is_alive(peer);
+        node["priority"] = peer.priority;
+        node["demand"] = peer.demand;
+        node["zones"] = peer.zones;
+        node["heating"] = peer.heating;
+        node["coordinator"] = peer.coordinator;
+        node["last_seen"] = peer.last_seen.elapsed_millis() / 1000;
+    }
+
+    return json;
+}
+
+JsonDocument get_config() {
+    JsonDocument json;
+    if (enabled()) {
+        json["name"] = name;
+        json["priority"] = priority;
+    }
+    return json;
+}
+
+}  // namespace Cluster
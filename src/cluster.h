@@ -0,0 +1,29 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Coordination of several Calor nodes sharing a boiler.  Every node publishes
+// a heat demand summary on the Home Assistant broker.  The live node with the
+// lowest priority value is elected coordinator and drives the boiler relay
+// with the aggregated demand of all nodes, the relays of other nodes stay off.
+// If the coordinator stops publishing, the next candidate takes over.  After
+// connecting, a node listens to its peers for a publish period before running
+// for coordinator, and takes over only once the previous one stepped down.  A
+// node which loses the broker controls its own zones, but only once a peer
+// which was coordinating would be considered gone.  Nodes which can't reach
+// each other, e.g. a coordinator cut off from the broker and its peers, may
+// then drive their relays at the same time.
+namespace Cluster {
+
+void init(const JsonVariantConst & config);
+void tick();
+
+// Returns the boiler relay state for this node, given the local demand
+bool boiler_demand(bool local_demand);
+
+bool enabled();
+JsonDocument get_status();
+JsonDocument get_config();
+
+};  // namespace Cluster
@@ -6,21 +6,28 @@
 #include <PicoSyslog.h>
 #include <PicoUtils.h>
 
+#include <algorithm>
 #include <vector>
 
+#include "resolver.h"
 #include "schalter.h"
 #include "sensor.h"
 #include "zone.h"
 
 extern PicoSyslog::Logger syslog;
-extern std::vector<Zone *> zones;
+extern std::vector<Zone> zones;
 extern bool healthy;
 extern PicoUtils::PinOutput heating_relay;
 extern String hostname;
+extern Zone * find_zone_by_name(const String & name);
 
 namespace HomeAssistant {
 
 PicoMQTT::Client mqtt;
+String broker;
+
+// Address mqtt.host was last set to
+IPAddress resolved_address;
 
 PicoHA::Device device(mqtt, "Calor", "mlesniew", "Calor");
 PicoHA::QueuedEvent reboot_event(device, "reboot", "Reboot");
@@ -28,6 +35,175 @@ PicoHA::QueuedEvent reboot_event(device, "reboot", "Reboot");
 PicoHA::BinarySensor problem_sensor(device, "problem", "Problem");
 PicoHA::BinarySensor boiler_sensor(device, "boiler", "Boiler");
 
+// Entities of a zone.  Zones are looked up by name on every access, so the
+// entities survive configuration reloads.
+struct ZoneEntities {
+    String name;
+    PicoHA::ChildDevice * device;
+    PicoHA::Climate * climate;
+    PicoHA::Switch * boost;
+    PicoHA::Sensor<String> * sensor_state;
+    PicoHA::Sensor<String> * schalter_state;
+
+    std::vector<PicoHA::Entity *> entities() const {
+        return {climate, boost, sensor_state, schalter_state};
+    }
+};
+
+std::vector<ZoneEntities> announced_zones;
+
+// Discovery topics of removed entities, cleared once connected
+std::vector<String> retracted_topics;
+
+void add_zone(const String & name) {
+    PicoHA::ChildDevice * zone_device = new PicoHA::ChildDevice(
+        device, name, "Calor " + name, "mlesniew", "Calor Zone", name);
+
+    PicoHA::Climate * climate =
+        new PicoHA::Climate(*zone_device, "climate", "");
+
+    climate->min_temp = Zone::min_desired.to_double();
+    climate->max_temp = Zone::max_desired.to_double();
+    climate->temp_step = 0.25;
+    climate->temperature_unit = PicoHA::Climate::TemperatureUnit::celsius;
+    climate->modes = {PicoHA::Climate::Mode::heat,
+                      PicoHA::Climate::Mode::off};
+
+    climate->mode_getter = [name] {
+        const Zone * zone = find_zone_by_name(name);
+        return zone && zone->enabled ? PicoHA::Climate::Mode::heat
+                                     : PicoHA::Climate::Mode::off;
+    };
+    climate->mode_setter = [name](PicoHA::Climate::Mode mode) {
+        Zone * zone = find_zone_by_name(name);
+        if (zone) {
+            zone->enabled = (mode == PicoHA::Climate::Mode::heat);
+        }
+    };
+
+    climate->action_getter = [name] {
+        const Zone * zone = find_zone_by_name(name);
+        if (!zone || !zone->enabled) {
+            return PicoHA::Climate::Action::off;
+        }
+        if (zone->get_state() == Zone::State::heat) {
+            return PicoHA::Climate::Action::heating;
+        } else {
+            return PicoHA::Climate::Action::idle;
+        }
+    };
+
+    climate->power_getter = [name] {
+        const Zone * zone = find_zone_by_name(name);
+        return zone && zone->enabled;
+    };
+    climate->power_setter = [name](bool value) {
+        Zone * zone = find_zone_by_name(name);
+        if (zone) {
+            zone->enabled = value;
+        }
+    };
+    climate->target_temperature_getter = [name] {
+        const Zone * zone = find_zone_by_name(name);
+        return zone ? zone->desired.to_double()
+                    : std::numeric_limits<double>::quiet_NaN();
+    };
+    climate->target_temperature_setter = [name](double value) {
+        Zone * zone = find_zone_by_name(name);
+        if (zone) {
+            zone->desired = Temperature::from_double(value);
+        }
+    };
+    climate->current_temperature_getter = [name] {
+        const Zone * zone = find_zone_by_name(name);
+        return zone ? zone->get_reading().to_double()
+                    : std::numeric_limits<double>::quiet_NaN();
+    };
+
+    PicoHA::Switch * boost =
+        new PicoHA::Switch(*zone_device, "boost", "Boost");
+
+    boost->getter = [name] {
+        const Zone * zone = find_zone_by_name(name);
+        return zone && zone->boost_active();
+    };
+    boost->setter = [name](bool value) {
+        Zone * zone = find_zone_by_name(name);
+        if (!zone) {
+            return;
+        } else if (value) {
+            zone->boost();
+        } else {
+            zone->boost(0);
+        }
+    };
+
+    PicoHA::Sensor<String> * sensor_state_sensor =
+        new PicoHA::Sensor<String>(*zone_device, "sensor_state",
+                                   "Sensor State");
+    sensor_state_sensor->icon = "thermometer";
+    sensor_state_sensor->getter = [name] {
+        const Zone * zone = find_zone_by_name(name);
+        return zone ? to_c_str(zone->get_sensor().get_state()) : "removed";
+    };
+    sensor_state_sensor->is_diagnostic = true;
+
+    PicoHA::Sensor<String> * schalter_state_sensor =
+        new PicoHA::Sensor<String>(*zone_device, "schalter_state",
+                                   "Schalter State");
+    schalter_state_sensor->icon = "electric-switch";
+    schalter_state_sensor->getter = [name] {
+        const Zone * zone = find_zone_by_name(name);
+        return zone ? to_c_str(zone->get_valve().get_state()) : "removed";
+    };
+    schalter_state_sensor->is_diagnostic = true;
+
+    announced_zones.push_back({name, zone_device, climate, boost,
+                               sensor_state_sensor, schalter_state_sensor});
+
+    // a zone removed and added again before the removal was published
+    for (const auto * entity : announced_zones.back().entities()) {
+        retracted_topics.erase(
+            std::remove(retracted_topics.begin(), retracted_topics.end(),
+                        entity->get_autodiscovery_topic()),
+            retracted_topics.end());
+    }
+}
+
+// Announces the entities of a zone added while connected, all entities are
+// announced on connect anyway
+void announce_zone(const ZoneEntities & entities) {
+    if (!mqtt.connected()) {
+        return;
+    }
+    for (auto * entity : entities.entities()) {
+        entity->publish_autodiscovery();
+    }
+}
+
+void remove_zone(const ZoneEntities & entities) {
+    for (const auto * entity : entities.entities()) {
+        retracted_topics.push_back(entity->get_autodiscovery_topic());
+    }
+
+    delete entities.schalter_state;
+    delete entities.sensor_state;
+    delete entities.boost;
+    delete entities.climate;
+    delete entities.device;
+}
+
+// An empty retained discovery config makes Home Assistant drop the entity
+void publish_retractions() {
+    if (!mqtt.connected()) {
+        return;
+    }
+    for (const auto & topic : retracted_topics) {
+        mqtt.publish(topic, "", 0, true);
+    }
+    retracted_topics.clear();
+}
+
 void init() {
     device.name = hostname;
 
@@ -41,75 +217,8 @@ void init() {
 
     PicoHA::add_diagnostic_entities(device);
 
-    for (auto zone : zones) {
-        PicoHA::ChildDevice * zone_device =
-            new PicoHA::ChildDevice(device, zone->name, "Calor " + zone->name,
-                                    "mlesniew", "Calor Zone", zone->name);
-
-        PicoHA::Climate * climate =
-            new PicoHA::Climate(*zone_device, "climate", "");
-
-        climate->min_temp = 7;
-        climate->max_temp = 25;
-        climate->temp_step = 0.25;
-        climate->temperature_unit = PicoHA::Climate::TemperatureUnit::celsius;
-        climate->modes = {PicoHA::Climate::Mode::heat,
-                          PicoHA::Climate::Mode::off};
-
-        climate->mode_getter = [zone] {
-            return zone->enabled ? PicoHA::Climate::Mode::heat
-                                 : PicoHA::Climate::Mode::off;
-        };
-        climate->mode_setter = [zone](PicoHA::Climate::Mode mode) {
-            zone->enabled = (mode == PicoHA::Climate::Mode::heat);
-        };
-
-        climate->action_getter = [zone] {
-            if (!zone->enabled) {
-                return PicoHA::Climate::Action::off;
-            }
-            if (zone->get_state() == Zone::State::heat) {
-                return PicoHA::Climate::Action::heating;
-            } else {
-                return PicoHA::Climate::Action::idle;
-            }
-        };
-
-        climate->bind_power(&(zone->enabled));
-        climate->bind_target_temperature(&(zone->desired));
-        climate->current_temperature_getter = [zone] {
-            return zone->get_reading();
-        };
-
-        PicoHA::Switch * boost =
-            new PicoHA::Switch(*zone_device, "boost", "Boost");
-
-        boost->getter = [zone] { return zone->boost_active(); };
-        boost->setter = [zone](bool value) {
-            if (value) {
-                zone->boost();
-            } else {
-                zone->boost(0);
-            }
-        };
-
-        PicoHA::Sensor<String> * sensor_state_sensor =
-            new PicoHA::Sensor<String>(*zone_device, "sensor_state",
-                                       "Sensor State");
-        sensor_state_sensor->icon = "thermometer";
-        sensor_state_sensor->getter = [zone] {
-            return to_c_str(zone->get_sensor()->get_state());
-        };
-        sensor_state_sensor->is_diagnostic = true;
-
-        PicoHA::Sensor<String> * schalter_state_sensor =
-            new PicoHA::Sensor<String>(*zone_device, "schalter_state",
-                                       "Schalter State");
-        schalter_state_sensor->icon = "electric-switch";
-        schalter_state_sensor->getter = [zone] {
-            return to_c_str(zone->get_valve()->get_state());
-        };
-        schalter_state_sensor->is_diagnostic = true;
+    for (const auto & zone : zones) {
+        add_zone(zone.name);
     }
 
     mqtt.begin();
@@ -117,14 +226,58 @@ void init() {
 }
 
 void tick() {
-    mqtt.loop();
+    // The broker address is only needed for reconnecting, so it's looked up
+    // while disconnected only, at most once per second.  The resolver's cache
+    // is used, so that reconnecting never waits for DNS.
+    static PicoUtils::Stopwatch last_lookup;
+    if (!mqtt.connected() && (last_lookup.elapsed_millis() >= 1000)) {
+        last_lookup.reset();
+        const IPAddress address = Resolver::resolve(broker);
+        if (!address.isSet()) {
+            mqtt.host = String();
+        } else if (address != resolved_address) {
+            mqtt.host = address.toString();
+        }
+        resolved_address = address;
+    }
+
+    if (mqtt.host.length()) {
+        mqtt.loop();
+    }
+    publish_retractions();
     device.tick();
 }
 
+void update_zones() {
+    for (auto it = announced_zones.begin(); it != announced_zones.end();) {
+        if (find_zone_by_name(it->name)) {
+            ++it;
+        } else {
+            syslog.printf("Removing Home Assistant entities of zone '%s'.\n",
+                          it->name.c_str());
+            remove_zone(*it);
+            it = announced_zones.erase(it);
+        }
+    }
+
+    for (const auto & zone : zones) {
+        const auto it = std::find_if(
+            announced_zones.begin(), announced_zones.end(),
+            [&zone](const ZoneEntities & e) { return e.name == zone.name; });
+        if (it == announced_zones.end()) {
+            add_zone(zone.name);
+            announce_zone(announced_zones.back());
+        }
+    }
+
+    // the broker connection stays up, so the cluster keeps its coordinator
+    publish_retractions();
+}
+
 bool connected() { return mqtt.connected(); }
 
 bool healthcheck() {
-    return !mqtt.host.length() || !mqtt.port || mqtt.connected();
+    return !broker.length() || !mqtt.port || mqtt.connected();
 }
 
 }  // namespace HomeAssistant
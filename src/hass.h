@@ -5,8 +5,15 @@
 namespace HomeAssistant {
 extern PicoMQTT::Client mqtt;
 
+// Configured broker host name, mqtt.host is set to its resolved address
+extern String broker;
+
 void init();
 void tick();
+
+// Adds and removes entities of zones added or removed after init().  Only the
+// changed entities are announced or removed, without reconnecting.
+void update_zones();
 bool healthcheck();
 bool connected();
 
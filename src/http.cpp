@@ -0,0 +1,456 @@
+#include "http.h"
+
+#include <PicoSyslog.h>
+
+extern PicoSyslog::Logger syslog;
+
+namespace {
+
+const char * reason(int code) {
+    switch (code) {
+        case 200:
+            return "OK";
+        case 400:
+            return "Bad Request";
+        case 404:
+            return "Not Found";
+        case 405:
+            return "Method Not Allowed";
+        case 413:
+            return "Payload Too Large";
+        case 414:
+            return "URI Too Long";
+        case 431:
+            return "Request Header Fields Too Large";
+        case 500:
+            return "Internal Server Error";
+        case 501:
+            return "Not Implemented";
+        default:
+            return "";
+    }
+}
+
+HttpServer::Method parse_method(const String & method) {
+    if (method == "GET") {
+        return HttpServer::Method::get;
+    } else if (method == "POST") {
+        return HttpServer::Method::post;
+    } else if (method == "PUT") {
+        return HttpServer::Method::put;
+    } else if (method == "PATCH") {
+        return HttpServer::Method::patch;
+    } else if (method == "DELETE") {
+        return HttpServer::Method::del;
+    } else {
+        return HttpServer::Method::other;
+    }
+}
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+String url_decode(const String & text) {
+    String ret;
+    ret.reserve(text.length());
+    for (unsigned int i = 0; i < text.length(); ++i) {
+        if (text[i] == '%' && i + 2 < text.length() &&
+            hex_value(text[i + 1]) >= 0 && hex_value(text[i + 2]) >= 0) {
+            ret += (char)(hex_value(text[i + 1]) * 16 +
+                          hex_value(text[i + 2]));
+            i += 2;
+        } else {
+            ret += text[i];
+        }
+    }
+    return ret;
+}
+
+// Returns the segment of path starting at pos and advances pos past it.
+String next_segment(const String & path, unsigned int & pos) {
+    const int end = path.indexOf('/', pos);
+    const String segment =
+        end < 0 ? path.substring(pos) : path.substring(pos, end);
+    pos = end < 0 ? path.length() + 1 : end + 1;
+    return segment;
+}
+
+bool match(const String & pattern, const String & path,
+           std::vector<String> & args) {
+    args.clear();
+    unsigned int pattern_pos = 0;
+    unsigned int path_pos = 0;
+    while (pattern_pos <= pattern.length() && path_pos <= path.length()) {
+        const String expected = next_segment(pattern, pattern_pos);
+        const String actual = next_segment(path, path_pos);
+        if (expected == "*") {
+            if (!actual.length()) {
+                return false;
+            }
+            args.push_back(url_decode(actual));
+        } else if (expected != actual) {
+            return false;
+        }
+    }
+    return pattern_pos > pattern.length() && path_pos > path.length();
+}
+
+String build_response(int code, const char * content_type,
+                      const String & content) {
+    String response = "HTTP/1.1 " + String(code) + " " + reason(code) + "\r\n";
+    if (content_type && content_type[0]) {
+        response += "Content-Type: ";
+        response += content_type;
+        response += "\r\n";
+    }
+    response += "Content-Length: " + String(content.length()) + "\r\n";
+    response += "Connection: close\r\n\r\n";
+    response += content;
+    return response;
+}
+
+}  // namespace
+
+HttpServer::HttpServer(uint16_t port, size_t max_connections)
+    : server(port),
+      connections(max_connections),
+      next_connection(0),
+      current(nullptr) {}
+
+void HttpServer::on(const String & path, Method method, Handler handler) {
+    routes.push_back({path, method, handler});
+}
+
+void HttpServer::begin() {
+    server.begin();
+    server.setNoDelay(true);
+}
+
+void HttpServer::accept() {
+    for (auto & connection : connections) {
+        if (connection.state != Connection::State::closed) {
+            continue;
+        }
+
+        WiFiClient client = server.accept();
+        if (!client) {
+            // pending connections stay in the backlog until a slot frees up
+            return;
+        }
+
+        client.setNoDelay(true);
+        connection.send_capacity = client.availableForWrite();
+        connection.client = client;
+        connection.state = Connection::State::request_line;
+        connection.state_start = millis();
+        connection.line = "";
+        connection.method = Method::other;
+        connection.path = "";
+        connection.body = "";
+        connection.content_length = 0;
+        connection.response = "";
+        connection.sent = 0;
+    }
+}
+
+void HttpServer::close(Connection & connection, bool graceful) {
+    // stop() flushes first, which can wait for the client for a long time
+    if (graceful) {
+        connection.client.stop();
+    } else {
+        connection.client.abort();
+    }
+    connection.client = WiFiClient();
+    connection.state = Connection::State::closed;
+
+    // release memory early, connections stay allocated
+    connection.line = String();
+    connection.path = String();
+    connection.body = String();
+    connection.response = String();
+}
+
+void HttpServer::respond(Connection & connection, int code) {
+    connection.response = build_response(code, "", "");
+    connection.sent = 0;
+    connection.state = Connection::State::response;
+    connection.state_start = millis();
+}
+
+bool HttpServer::process_line(Connection & connection) {
+    String & line = connection.line;
+
+    if (connection.state == Connection::State::request_line) {
+        if (!line.length()) {
+            // tolerate empty lines before the request line
+            return true;
+        }
+
+        const int first_space = line.indexOf(' ');
+        const int second_space =
+            first_space < 0 ? -1 : line.indexOf(' ', first_space + 1);
+        if (second_space < 0) {
+            respond(connection, 400);
+            return false;
+        }
+
+        connection.method = parse_method(line.substring(0, first_space));
+        connection.path = line.substring(first_space + 1, second_space);
+
+        const int query = connection.path.indexOf('?');
+        if (query >= 0) {
+            connection.path = connection.path.substring(0, query);
+        }
+
+        connection.state = Connection::State::headers;
+        return true;
+    }
+
+    // header line
+    if (!line.length()) {
+        if (connection.content_length > max_body) {
+            respond(connection, 413);
+            return false;
+        } else if (connection.content_length) {
+            if (!connection.body.reserve(connection.content_length)) {
+                respond(connection, 413);
+                return false;
+            }
+            connection.state = Connection::State::body;
+            return true;
+        } else {
+            dispatch(connection);
+            return false;
+        }
+    }
+
+    const int colon = line.indexOf(':');
+    if (colon < 0) {
+        respond(connection, 400);
+        return false;
+    }
+
+    String name = line.substring(0, colon);
+    name.toLowerCase();
+    if (name == "content-length") {
+        String value = line.substring(colon + 1);
+        value.trim();
+        connection.content_length = value.toInt();
+    } else if (name == "transfer-encoding") {
+        respond(connection, 501);
+        return false;
+    }
+
+    return true;
+}
+
+void HttpServer::dispatch(Connection & connection) {
+    bool path_found = false;
+    for (const auto & route : routes) {
+        if (!match(route.path, connection.path, path_args)) {
+            continue;
+        }
+        path_found = true;
+        if (route.method != connection.method) {
+            continue;
+        }
+
+        current = &connection;
+        connection.response = "";
+        route.handler();
+        current = nullptr;
+
+        if (!connection.response.length()) {
+            respond(connection, 500);
+        } else {
+            connection.sent = 0;
+            connection.state = Connection::State::response;
+            connection.state_start = millis();
+        }
+        return;
+    }
+
+    respond(connection, path_found ? 405 : 404);
+}
+
+size_t HttpServer::receive(Connection & connection, size_t budget) {
+    uint8_t buffer[64];
+    size_t used = 0;
+
+    while (used < budget) {
+        const int available = connection.client.available();
+        if (available <= 0) {
+            break;
+        }
+
+        size_t size = std::min(sizeof(buffer), budget - used);
+        size = std::min(size, (size_t)available);
+        if (connection.state == Connection::State::body) {
+            size = std::min(size, connection.content_length -
+                                      connection.body.length());
+        }
+
+        const int read = connection.client.read(buffer, size);
+        if (read <= 0) {
+            break;
+        }
+        used += read;
+
+        for (int i = 0; i < read; ++i) {
+            const char c = buffer[i];
+
+            if (connection.state == Connection::State::body) {
+                const size_t missing =
+                    connection.content_length - connection.body.length();
+                connection.body.concat((const char *)buffer + i,
+                                       std::min((size_t)(read - i), missing));
+                if (connection.body.length() >= connection.content_length) {
+                    dispatch(connection);
+                }
+                break;
+            }
+
+            if (c == '\n') {
+                if (!process_line(connection)) {
+                    // response ready, ignore whatever else the client sent
+                    return used;
+                }
+                connection.line = "";
+            } else if (c != '\r') {
+                const size_t limit =
+                    connection.state == Connection::State::request_line
+                        ? max_request_line
+                        : max_header_line;
+                if (connection.line.length() >= limit) {
+                    respond(connection,
+                            connection.state == Connection::State::request_line
+                                ? 414
+                                : 431);
+                    return used;
+                }
+                connection.line += c;
+            }
+        }
+
+        if (connection.state == Connection::State::response) {
+            break;
+        }
+    }
+
+    return used;
+}
+
+size_t HttpServer::transmit(Connection & connection, size_t budget) {
+    const size_t remaining = connection.response.length() - connection.sent;
+
+    // only write what fits in the TCP send buffer, so that write never waits
+    size_t size = std::min(remaining, budget);
+    size = std::min(size, (size_t)connection.client.availableForWrite());
+
+    if (size) {
+        size = connection.client.write(
+            (const uint8_t *)connection.response.c_str() + connection.sent,
+            size);
+        connection.sent += size;
+    }
+
+    if (connection.sent >= connection.response.length()) {
+        connection.state = Connection::State::draining;
+        connection.state_start = millis();
+        connection.response = String();
+    }
+
+    return size;
+}
+
+void HttpServer::drain(Connection & connection) {
+    // the send buffer is back to its initial size once the client
+    // acknowledged everything
+    if ((size_t)connection.client.availableForWrite() >=
+        connection.send_capacity) {
+        close(connection, true);
+    }
+}
+
+void HttpServer::loop() {
+    accept();
+
+    size_t read_budget = max_read_per_loop;
+    size_t write_budget = max_write_per_loop;
+
+    // start with a different connection each time, so that one busy client
+    // can't use up the whole budget every time
+    for (size_t i = 0; i < connections.size(); ++i) {
+        Connection & connection =
+            connections[(next_connection + i) % connections.size()];
+
+        if (connection.state == Connection::State::closed) {
+            continue;
+        }
+
+        const bool responding =
+            connection.state == Connection::State::response ||
+            connection.state == Connection::State::draining;
+
+        if (!connection.client.connected() &&
+            (responding || !connection.client.available())) {
+            close(connection);
+            continue;
+        }
+
+        if (connection.state == Connection::State::draining) {
+            drain(connection);
+        } else if (responding) {
+            write_budget -= transmit(connection, write_budget);
+        } else {
+            read_budget -= receive(connection, read_budget);
+        }
+
+        if (connection.state == Connection::State::closed) {
+            continue;
+        }
+
+        unsigned long timeout = request_timeout_ms;
+        if (connection.state == Connection::State::response) {
+            timeout = response_timeout_ms;
+        } else if (connection.state == Connection::State::draining) {
+            timeout = drain_timeout_ms;
+        }
+        if (millis() - connection.state_start >= timeout) {
+            syslog.printf("HTTP connection from %s timed out.\n",
+                          connection.client.remoteIP().toString().c_str());
+            close(connection);
+        }
+    }
+
+    if (connections.size()) {
+        next_connection = (next_connection + 1) % connections.size();
+    }
+}
+
+const String & HttpServer::decodedPathArg(size_t idx) const {
+    static const String empty;
+    return idx < path_args.size() ? path_args[idx] : empty;
+}
+
+const String & HttpServer::body() const {
+    static const String empty;
+    return current ? current->body : empty;
+}
+
+void HttpServer::send(int code, const char * content_type,
+                      const String & content) {
+    if (current) {
+        current->response = build_response(code, content_type, content);
+    }
+}
+
+void HttpServer::sendJson(const JsonVariantConst & json, int code) {
+    String content;
+    serializeJson(json, content);
+    send(code, "application/json", content);
+}
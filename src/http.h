@@ -0,0 +1,111 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ESP8266WiFi.h>
+
+#include <functional>
+#include <vector>
+
+// Minimal HTTP/1.1 server, which never blocks the control loop.  Each call to
+// loop() advances the state machines of all open connections, but parses and
+// sends at most a fixed number of bytes in total.  Connections which take too
+// long to deliver a request or to receive the response are dropped.  After the
+// response is written, the connection waits for the client to acknowledge it
+// before closing, so closing never has to wait for the network.
+class HttpServer {
+public:
+    enum class Method {
+        get,
+        post,
+        put,
+        patch,
+        del,
+        other,
+    };
+
+    typedef std::function<void()> Handler;
+
+    HttpServer(uint16_t port, size_t max_connections = 4);
+
+    // Paths are matched exactly, except for a trailing "*" segment, which
+    // matches any single path segment.  Matched segments are available via
+    // decodedPathArg() while the handler runs.
+    void on(const String & path, Method method, Handler handler);
+
+    void begin();
+    void loop();
+
+    // The following are only valid inside handlers
+    const String & decodedPathArg(size_t idx) const;
+    const String & body() const;
+    void send(int code, const char * content_type = "",
+              const String & content = "");
+    void sendJson(const JsonVariantConst & json, int code = 200);
+
+    size_t max_request_line = 256;
+    size_t max_header_line = 512;
+    // Large enough for the config of 32 zones with schedules, as returned by
+    // GET /config.  Bodies which don't fit in the heap are refused anyway.
+    size_t max_body = 16 * 1024;
+
+    size_t max_read_per_loop = 1024;
+    size_t max_write_per_loop = 2048;
+
+    unsigned long request_timeout_ms = 5 * 1000;
+    unsigned long response_timeout_ms = 10 * 1000;
+    unsigned long drain_timeout_ms = 2 * 1000;
+
+protected:
+    struct Route {
+        String path;
+        Method method;
+        Handler handler;
+    };
+
+    struct Connection {
+        enum class State {
+            closed,
+            request_line,
+            headers,
+            body,
+            response,
+            draining,
+        };
+
+        Connection() : state(State::closed) {}
+
+        WiFiClient client;
+        State state;
+        unsigned long state_start;
+        String line;
+        Method method;
+        String path;
+        String body;
+        size_t content_length;
+        String response;
+        size_t sent;
+        // free TCP send buffer of an idle connection
+        size_t send_capacity;
+    };
+
+    void accept();
+    size_t receive(Connection & connection, size_t budget);
+    size_t transmit(Connection & connection, size_t budget);
+    bool process_line(Connection & connection);
+    void dispatch(Connection & connection);
+    void respond(Connection & connection, int code);
+    void drain(Connection & connection);
+
+    // Graceful closing only happens once all data is acknowledged, otherwise
+    // the connection is aborted
+    void close(Connection & connection, bool graceful = false);
+
+    WiFiServer server;
+    std::vector<Route> routes;
+    std::vector<Connection> connections;
+    size_t next_connection;
+
+    Connection * current;
+    std::vector<String> path_args;
+};
@@ -0,0 +1,227 @@
+#include "mqtt.h"
+
+#include <Arduino.h>
+#include <PicoSyslog.h>
+
+#include <algorithm>
+
+extern PicoSyslog::Logger syslog;
+
+namespace {
+
+bool topic_matches(const char * filter, const char * topic) {
+    while (*filter) {
+        if (*filter == '#') {
+            // multi-level wildcard, matches the rest of the topic
+            return true;
+        } else if (*filter == '+') {
+            // single-level wildcard
+            while (*topic && *topic != '/') ++topic;
+            ++filter;
+        } else if (*filter++ != *topic++) {
+            return false;
+        }
+    }
+    return !*topic;
+}
+
+}  // namespace
+
+MQTTServer::MQTTServer()
+    : messages_in(0),
+      messages_out(0),
+      bytes_in(0),
+      fanout_us(0),
+      max_fanout_seen_us(0),
+      window_messages_in(0),
+      window_messages_out(0),
+      window_max_loop_us(0),
+      in_per_second(0),
+      out_per_second(0),
+      max_loop_us(0) {}
+
+void MQTTServer::loop() {
+    const unsigned long start = micros();
+    PicoMQTT::Server::loop();
+    window_max_loop_us =
+        std::max(window_max_loop_us, (uint32_t)(micros() - start));
+
+    const unsigned long elapsed = rate_window.elapsed_millis();
+    if (elapsed >= rate_window_ms) {
+        in_per_second = (uint64_t)window_messages_in * 1000 / elapsed;
+        out_per_second = (uint64_t)window_messages_out * 1000 / elapsed;
+        max_loop_us = window_max_loop_us;
+        window_messages_in = window_messages_out = window_max_loop_us = 0;
+        rate_window.reset();
+    }
+}
+
+MQTTServer::ClientStats * MQTTServer::find_client(const char * client_id) {
+    for (auto & client : clients) {
+        if (client.id == client_id) {
+            return &client;
+        }
+    }
+    return nullptr;
+}
+
+MQTTServer::TopicStats * MQTTServer::find_topic(const char * topic) {
+    for (auto & stats : topics) {
+        if (stats.topic == topic) {
+            return &stats;
+        }
+    }
+    if (topics.size() >= max_topics) {
+        return nullptr;
+    }
+    topics.emplace_back(topic);
+    return &topics.back();
+}
+
+void MQTTServer::on_connected(const char * client_id) {
+    if (!find_client(client_id) && (clients.size() < max_clients)) {
+        clients.emplace_back(client_id);
+    }
+}
+
+void MQTTServer::on_disconnected(const char * client_id) {
+    clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                 [client_id](const ClientStats & client) {
+                                     return client.id == client_id;
+                                 }),
+                  clients.end());
+}
+
+void MQTTServer::on_subscribe(const char * client_id, const char * topic) {
+    ClientStats * client = find_client(client_id);
+    if (client && (client->subscriptions.size() < max_subscriptions)) {
+        client->subscriptions.push_back(topic);
+    }
+}
+
+void MQTTServer::on_unsubscribe(const char * client_id, const char * topic) {
+    ClientStats * client = find_client(client_id);
+    if (client) {
+        auto & subscriptions = client->subscriptions;
+        subscriptions.erase(
+            std::remove(subscriptions.begin(), subscriptions.end(), topic),
+            subscriptions.end());
+    }
+}
+
+void MQTTServer::on_message(const char * topic,
+                            PicoMQTT::IncomingPacket & packet) {
+    last_message.reset();
+
+    const size_t size = packet.get_remaining_size();
+
+    const unsigned long start = micros();
+    PicoMQTT::Server::on_message(topic, packet);
+    const uint32_t elapsed = micros() - start;
+
+    // PicoMQTT doesn't report the recipients, count the matching
+    // subscriptions instead
+    uint32_t deliveries = 0;
+    ClientStats * recipient = nullptr;
+    for (auto & client : clients) {
+        for (const auto & filter : client.subscriptions) {
+            if (topic_matches(filter.c_str(), topic)) {
+                ++deliveries;
+                ++client.delivered;
+                recipient = &client;
+                break;
+            }
+        }
+    }
+
+    // with more recipients, the time can't be split between them
+    if (deliveries == 1) {
+        ++recipient->timed;
+        recipient->delivery_us +=
+            ((int32_t)elapsed - (int32_t)recipient->delivery_us) / 8;
+    }
+
+    ++messages_in;
+    ++window_messages_in;
+    messages_out += deliveries;
+    window_messages_out += deliveries;
+    bytes_in += size;
+    fanout_us += ((int32_t)elapsed - (int32_t)fanout_us) / 8;
+    max_fanout_seen_us = std::max(max_fanout_seen_us, elapsed);
+
+    TopicStats * stats = find_topic(topic);
+    if (stats) {
+        ++stats->messages;
+        stats->deliveries += deliveries;
+        stats->bytes += size;
+        stats->fanout_us = std::max(stats->fanout_us, elapsed);
+    }
+}
+
+const MQTTServer::ClientStats * MQTTServer::get_slowest_client() const {
+    const ClientStats * slowest = nullptr;
+    for (const auto & client : clients) {
+        if (client.timed &&
+            (!slowest || client.delivery_us > slowest->delivery_us)) {
+            slowest = &client;
+        }
+    }
+    return slowest;
+}
+
+bool MQTTServer::healthcheck() const {
+    const ClientStats * slowest = get_slowest_client();
+    if (slowest && (slowest->delivery_us >= max_fanout_us)) {
+        syslog.printf("MQTT client %s takes %u us per message on average.\n",
+                      slowest->id.c_str(), (unsigned)slowest->delivery_us);
+        return false;
+    }
+    if (fanout_us >= max_fanout_us) {
+        syslog.printf("MQTT fan-out takes %u us on average.\n",
+                      (unsigned)fanout_us);
+        return false;
+    }
+    return true;
+}
+
+JsonDocument MQTTServer::get_status() const {
+    JsonDocument json;
+
+    json["messages_in"] = messages_in;
+    json["messages_out"] = messages_out;
+    json["bytes_in"] = bytes_in;
+    json["in_per_second"] = in_per_second;
+    json["out_per_second"] = out_per_second;
+    json["fanout_us"] = fanout_us;
+    json["max_fanout_us"] = max_fanout_seen_us;
+    json["max_loop_us"] = max_loop_us;
+    json["free_heap"] = ESP.getFreeHeap();
+    json["max_free_block"] = ESP.getMaxFreeBlockSize();
+
+    const ClientStats * slowest = get_slowest_client();
+    if (slowest) {
+        json["slowest_client"] = slowest->id;
+    }
+
+    auto clients_json = json["clients"].to<JsonObject>();
+    for (const auto & client : clients) {
+        auto client_json = clients_json[client.id].to<JsonObject>();
+        client_json["connected"] = client.connected.elapsed();
+        client_json["subscriptions"] = client.subscriptions.size();
+        client_json["delivered"] = client.delivered;
+        if (client.timed) {
+            client_json["delivery_us"] = client.delivery_us;
+        }
+    }
+
+    auto topics_json = json["topics"].to<JsonObject>();
+    for (const auto & stats : topics) {
+        auto topic_json = topics_json[stats.topic].to<JsonObject>();
+        topic_json["messages"] = stats.messages;
+        topic_json["deliveries"] = stats.deliveries;
+        topic_json["bytes"] = stats.bytes;
+        topic_json["max_fanout_us"] = stats.fanout_us;
+    }
+
+    return json;
+}
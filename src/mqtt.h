@@ -1,19 +1,104 @@
 #pragma once
 
+#include <ArduinoJson.h>
 #include <PicoMQTT.h>
 #include <PicoUtils.h>
 
+#include <cstdint>
+#include <vector>
+
+// Local MQTT broker with metrics.  PicoMQTT delivers every message to all
+// subscribers synchronously, so a slow client shows up as time spent fanning
+// out the messages it subscribes to.  The broker keeps counters per client and
+// per topic, message rates and fan-out times.  Clients and topics beyond the
+// table limits are counted in the totals only.
+//
+// PicoMQTT has no per-client hooks for outgoing data and no way to drop a
+// single client, so the broker can neither queue per client nor disconnect a
+// stalled one.  Delivery times are only measured, and only attributed to a
+// client for messages it was the sole recipient of.  For the same reason a
+// failing healthcheck() is only logged, it doesn't count towards resetting the
+// device, which wouldn't get rid of a slow client anyway.
 class MQTTServer : public PicoMQTT::Server {
 public:
+    MQTTServer();
+
     const PicoUtils::Stopwatch & get_last_message_stopwatch() const {
         return last_message;
     }
 
+    void loop();
+
+    JsonDocument get_status() const;
+    bool healthcheck() const;
+
+    static const size_t max_clients = 32;
+    static const size_t max_topics = 32;
+    static const size_t max_subscriptions = 16;
+
+    // Average fan-out or delivery time to a single client above which the
+    // broker is considered unhealthy
+    unsigned long max_fanout_us = 250 * 1000;
+
 protected:
+    struct ClientStats {
+        ClientStats(const String & id)
+            : id(id), delivered(0), timed(0), delivery_us(0) {}
+
+        String id;
+        std::vector<String> subscriptions;
+        PicoUtils::Stopwatch connected;
+        uint32_t delivered;
+        // messages delivered to this client only, and the moving average of
+        // their delivery time
+        uint32_t timed;
+        uint32_t delivery_us;
+    };
+
+    struct TopicStats {
+        TopicStats(const String & topic)
+            : topic(topic),
+              messages(0),
+              deliveries(0),
+              bytes(0),
+              fanout_us(0) {}
+
+        const String topic;
+        uint32_t messages;
+        uint32_t deliveries;
+        uint32_t bytes;
+        uint32_t fanout_us;  // maximum
+    };
+
+    void on_message(const char * topic,
+                    PicoMQTT::IncomingPacket & packet) override;
+    void on_connected(const char * client_id) override;
+    void on_disconnected(const char * client_id) override;
+    void on_subscribe(const char * client_id, const char * topic) override;
+    void on_unsubscribe(const char * client_id, const char * topic) override;
+
+    ClientStats * find_client(const char * client_id);
+    TopicStats * find_topic(const char * topic);
+    const ClientStats * get_slowest_client() const;
+
     PicoUtils::Stopwatch last_message;
 
-    void on_message(const char * topic, PicoMQTT::IncomingPacket & packet) {
-        last_message.reset();
-        PicoMQTT::Server::on_message(topic, packet);
-    }
-};
\ No newline at end of file
+    std::vector<ClientStats> clients;
+    std::vector<TopicStats> topics;
+
+    uint32_t messages_in;
+    uint32_t messages_out;
+    uint32_t bytes_in;
+    uint32_t fanout_us;  // moving average
+    uint32_t max_fanout_seen_us;
+
+    // rates, updated every rate_window_ms
+    static const unsigned long rate_window_ms = 5 * 1000;
+    PicoUtils::Stopwatch rate_window;
+    uint32_t window_messages_in;
+    uint32_t window_messages_out;
+    uint32_t window_max_loop_us;
+    uint32_t in_per_second;
+    uint32_t out_per_second;
+    uint32_t max_loop_us;
+};
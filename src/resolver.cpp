@@ -0,0 +1,186 @@
+#include "resolver.h"
+
+#include <ESP8266WiFi.h>
+#include <PicoSyslog.h>
+#include <PicoUtils.h>
+#include <lwip/dns.h>
+
+#include <vector>
+
+extern PicoSyslog::Logger syslog;
+
+namespace Resolver {
+
+namespace {
+
+const unsigned long ttl_ms = 10 * 60 * 1000;
+const unsigned long refresh_ms = 8 * 60 * 1000;
+const unsigned long retry_ms = 15 * 1000;
+const unsigned long lookup_timeout_ms = 30 * 1000;
+
+struct Entry {
+    Entry(const String & host)
+        : host(host), pending(false), failed(false), lookup_start(0) {}
+
+    const String host;
+    IPAddress address;
+    bool pending;
+    bool failed;
+    unsigned long lookup_start;
+    PicoUtils::Stopwatch last_update;
+};
+
+std::vector<Entry> entries;
+
+unsigned long hits = 0;
+unsigned long stale_hits = 0;
+unsigned long misses = 0;
+unsigned long lookups = 0;
+unsigned long failures = 0;
+unsigned long last_latency_ms = 0;
+unsigned long max_latency_ms = 0;
+
+void finish_lookup(Entry & entry, const IPAddress & address, bool success) {
+    const unsigned long latency = millis() - entry.lookup_start;
+    last_latency_ms = latency;
+    max_latency_ms = std::max(max_latency_ms, latency);
+
+    entry.pending = false;
+    entry.failed = !success;
+    entry.last_update.reset();
+
+    if (success) {
+        entry.address = address;
+    } else {
+        // keep serving the previous address, if any
+        ++failures;
+    }
+}
+
+void dns_found(const char *, const ip_addr_t * ipaddr, void * arg) {
+    const size_t idx = (size_t)arg;
+    if (idx >= entries.size() || !entries[idx].pending) {
+        return;
+    }
+    finish_lookup(entries[idx], ipaddr ? IPAddress(ipaddr) : IPAddress(),
+                  ipaddr != nullptr);
+}
+
+void start_lookup(size_t idx) {
+    Entry & entry = entries[idx];
+
+    if (WiFi.status() != WL_CONNECTED) {
+        return;
+    }
+
+    ++lookups;
+    entry.pending = true;
+    entry.lookup_start = millis();
+
+    ip_addr_t addr;
+    const err_t err = dns_gethostbyname(entry.host.c_str(), &addr, dns_found,
+                                        (void *)idx);
+
+    if (err == ERR_OK) {
+        // answered from lwIP's own cache
+        finish_lookup(entry, IPAddress(&addr), true);
+    } else if (err != ERR_INPROGRESS) {
+        syslog.printf("Error resolving %s.\n", entry.host.c_str());
+        finish_lookup(entry, IPAddress(), false);
+    }
+}
+
+bool needs_lookup(const Entry & entry) {
+    if (entry.pending) {
+        return false;
+    }
+
+    if (entry.failed) {
+        return entry.last_update.elapsed_millis() >= retry_ms;
+    }
+
+    if (!entry.address.isSet()) {
+        // not looked up yet, probably because WiFi was down
+        return true;
+    }
+
+    return entry.last_update.elapsed_millis() >= refresh_ms;
+}
+
+}  // namespace
+
+IPAddress resolve(const String & host) {
+    IPAddress address;
+
+    if (!host.length()) {
+        return address;
+    }
+
+    if (address.fromString(host.c_str())) {
+        return address;
+    }
+
+    for (size_t idx = 0; idx < entries.size(); ++idx) {
+        Entry & entry = entries[idx];
+        if (entry.host != host) {
+            continue;
+        }
+
+        if (!entry.address.isSet()) {
+            ++misses;
+        } else if (entry.last_update.elapsed_millis() >= ttl_ms) {
+            ++stale_hits;
+        } else {
+            ++hits;
+        }
+
+        return entry.address;
+    }
+
+    ++misses;
+    entries.emplace_back(host);
+    start_lookup(entries.size() - 1);
+    return entries.back().address;
+}
+
+void tick() {
+    for (size_t idx = 0; idx < entries.size(); ++idx) {
+        Entry & entry = entries[idx];
+
+        if (entry.pending &&
+            (millis() - entry.lookup_start >= lookup_timeout_ms)) {
+            finish_lookup(entry, IPAddress(), false);
+        }
+
+        if (needs_lookup(entry)) {
+            start_lookup(idx);
+        }
+    }
+}
+
+JsonDocument get_status() {
+    JsonDocument json;
+
+    json["hits"] = hits;
+    json["stale_hits"] = stale_hits;
+    json["misses"] = misses;
+    json["lookups"] = lookups;
+    json["failures"] = failures;
+    json["last_latency_ms"] = last_latency_ms;
+    json["max_latency_ms"] = max_latency_ms;
+
+    auto hosts = json["hosts"].to<JsonObject>();
+    for (const auto & entry : entries) {
+        auto host = hosts[entry.host].to<JsonObject>();
+        if (entry.address.isSet()) {
+            host["address"] = entry.address.toString();
+        }
+        host["age"] = entry.last_update.elapsed_millis() / 1000;
+        host["pending"] = entry.pending;
+        host["failed"] = entry.failed;
+    }
+
+    return json;
+}
+
+}  // namespace Resolver
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <IPAddress.h>
+
+// Caching host name resolver.  Lookups run in the background, so resolve()
+// never waits for DNS.  Entries are refreshed before they expire and the last
+// known address is kept if a refresh fails.
+namespace Resolver {
+
+// Returns the cached address of the given host or an unset address if it's not
+// known yet.  IP address literals are returned as they are.
+IPAddress resolve(const String & host);
+
+void tick();
+JsonDocument get_status();
+
+};  // namespace Resolver
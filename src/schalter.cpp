@@ -3,6 +3,11 @@
 #include <PicoMQTT.h>
 #include <PicoSyslog.h>
 
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <vector>
+
 #include "mqtt.h"
 
 extern PicoSyslog::Logger syslog;
@@ -10,11 +15,100 @@ extern MQTTServer mqtt;
 
 namespace {
 
-std::list<Schalter *> schalters;
+std::vector<Schalter> schalters;
+std::vector<uint8_t> set_members;
+
+// Handlers refer to schalters by index, so they're subscribed again whenever
+// the index changes
+void subscribe(uint8_t idx) {
+    const String topic = "schalter/" + schalters[idx].name;
+    mqtt.subscribe(topic, [idx](const String & payload) {
+        Schalter & schalter = schalters[idx];
+        Serial.printf("Got update on valve %s: %s\n", schalter.name.c_str(),
+                      payload.c_str());
+        if (payload == "ON") {
+            schalter.update(Schalter::State::active);
+        } else if (payload == "OFF") {
+            schalter.update(Schalter::State::inactive);
+        } else if (payload == "TON") {
+            schalter.update(Schalter::State::activating);
+        } else if (payload == "TOFF") {
+            schalter.update(Schalter::State::deactivating);
+        } else {
+            syslog.printf("Invalid schalter state on valve %s: %s\n",
+                          schalter.name.c_str(), payload.c_str());
+        }
+    });
+}
+
+// Returns the index of the schalter with the given name, creating it if needed,
+// or -1 if there's no room for more schalters
+int find_or_add_schalter(const String & name) {
+    for (size_t idx = 0; idx < schalters.size(); ++idx) {
+        if (schalters[idx].name == name) {
+            return idx;
+        }
+    }
 
+    if (schalters.size() > std::numeric_limits<uint8_t>::max()) {
+        syslog.printf("Too many schalters, ignoring %s.\n", name.c_str());
+        return -1;
+    }
+
+    const uint8_t idx = schalters.size();
+    schalters.emplace_back(name);
+    subscribe(idx);
+
+    return idx;
+}
+
+void collect_schalters(const JsonVariantConst & json,
+                       std::vector<uint8_t> & elements) {
+    if (json.is<String>() || json.is<JsonObjectConst>()) {
+        // either just the name or an object with the name and switch time
+        const bool is_object = json.is<JsonObjectConst>();
+        const String name =
+            is_object ? json["name"].as<String>() : json.as<String>();
+
+        if (name.length() == 0) {
+            return;
+        }
+
+        const int idx = find_or_add_schalter(name);
+        if (idx < 0) {
+            return;
+        }
+
+        // a plain name leaves the switch time to other zones sharing the
+        // schalter
+        if (is_object) {
+            Schalter & schalter = schalters[idx];
+            const unsigned long switch_time_ms =
+                (json["switch_time"] | 0ul) * 1000;
+            if (schalter.switch_time_ms &&
+                (schalter.switch_time_ms != switch_time_ms)) {
+                syslog.printf(
+                    "Conflicting switch times of schalter %s, using the "
+                    "longest.\n",
+                    name.c_str());
+            }
+            schalter.switch_time_ms =
+                std::max(schalter.switch_time_ms, switch_time_ms);
+        }
+
+        elements.push_back(idx);
+    } else if (json.is<JsonArrayConst>()) {
+        // nested sets are flattened, their elements are requested together
+        // anyway
+        for (const JsonVariantConst & value : json.as<JsonArrayConst>()) {
+            collect_schalters(value, elements);
+        }
+    }
 }
 
-const char *to_c_str(const Schalter::State &s) {
+}  // namespace
+
+const char * to_c_str(const Schalter::State & s) {
     switch (s) {
         case Schalter::State::init:
             return "init";
@@ -31,31 +125,19 @@ const char *to_c_str(const Schalter::State &s) {
     }
 }
 
-Schalter::Schalter(const String &name) : name(name), last_request(false) {
+Schalter::Schalter(const String & name)
+    : name(name),
+      switch_time_ms(0),
+      ticks(0),
+      state(State::init),
+      last_request(false) {
     if (!name.length()) {
         set_state(State::error);
-        return;
     }
-
-    mqtt.subscribe("schalter/" + name, [this](const String &payload) {
-        Serial.printf("Got update on valve %s: %s\n", this->name.c_str(),
-                      payload.c_str());
-        if (payload == "ON") {
-            set_state(State::active);
-        } else if (payload == "OFF") {
-            set_state(State::inactive);
-        } else if (payload == "TON") {
-            set_state(State::activating);
-        } else if (payload == "TOFF") {
-            set_state(State::deactivating);
-        } else {
-            syslog.printf("Invalid schalter state on valve %s: %s\n",
-                          this->name.c_str(), payload.c_str());
-        }
-    });
 }
 
-void AbstractSchalter::set_state(State new_state) {
+void Schalter::set_state(State new_state) {
+    last_update.reset();
     if (state == new_state) {
         return;
     }
@@ -64,14 +146,39 @@ void AbstractSchalter::set_state(State new_state) {
     state = new_state;
 }
 
-void AbstractSchalter::set_request(const void *requester, bool requesting) {
-    if (requesting) {
-        requesters.insert(requester);
-    } else {
-        requesters.erase(requester);
+void Schalter::update(State new_state) {
+    if (is_ok()) {
+        arrivals.sample(last_update.elapsed_millis());
     }
+    set_state(new_state);
 }
 
+void Schalter::restore(State new_state) {
+    set_state(new_state);
+    // the time of the last update before the reset isn't known
+    arrivals.skip_next();
+}
+
+void Schalter::set_request(size_t requester, bool requesting) {
+    requesters.set(requester, requesting);
+}
+
+bool Schalter::is_open() const {
+    if (state == State::active) {
+        return true;
+    }
+    // TON is sent as soon as the valve starts moving, so after the switch
+    // time it's open even if the ON confirmation is still on its way.  The
+    // assumption only holds until twice the switch time, tick() puts the valve
+    // into error state then.
+    return (state == State::activating) && switch_time_ms &&
+           has_activation_requests() &&
+           (state.elapsed_millis() >= switch_time_ms) &&
+           (state.elapsed_millis() < 2 * switch_time_ms);
+}
+
+void Schalter::clear_requests() { requesters.reset(); }
+
 void Schalter::publish_request() {
     if (name.length()) {
         const bool activate = has_activation_requests();
@@ -80,59 +187,118 @@ void Schalter::publish_request() {
     }
 }
 
-void Schalter::tick() {
+void Schalter::tick_request() {
     if ((last_request.elapsed_millis() >= 30 * 1000) ||
         (last_request != has_activation_requests())) {
         publish_request();
     }
+}
 
-    if (last_update.elapsed_millis() >= 2 * 60 * 1000) {
+void Schalter::tick() {
+    ++ticks;
+    if (last_update.elapsed_millis() >= arrivals.timeout(timeout)) {
+        set_state(State::error);
+    } else if ((state == State::activating) && switch_time_ms &&
+               (state.elapsed_millis() >= 2 * switch_time_ms)) {
+        syslog.printf("Schalter %s not confirmed open within %lu ms.\n",
+                      str().c_str(), 2 * switch_time_ms);
         set_state(State::error);
     }
 }
 
-void Schalter::set_state(State new_state) {
-    last_update.reset();
-    AbstractSchalter::set_state(new_state);
-}
-
 JsonDocument Schalter::get_config() const {
     JsonDocument json;
-    json = name;
+    if (switch_time_ms) {
+        json["name"] = name;
+        json["switch_time"] = switch_time_ms / 1000;
+    } else {
+        json = name;
+    }
     return json;
 }
 
 String SchalterSet::str() const {
+    if (!is_list) {
+        return size ? schalters[set_members[first]].str() : "";
+    }
+
     String ret;
-    bool first = true;
-    for (AbstractSchalter *schalter : schalters) {
-        if (first) {
-            ret = schalter->str();
-            first = false;
-        } else {
-            ret = ret + ", " + schalter->str();
+    for (uint16_t idx = first; idx < first + size; ++idx) {
+        if (idx != first) {
+            ret += ", ";
         }
-    };
+        ret += schalters[set_members[idx]].str();
+    }
     return "[" + ret + "]";
 }
 
 JsonDocument SchalterSet::get_config() const {
     JsonDocument json;
-    size_t idx = 0;
-    for (AbstractSchalter *schalter : schalters) {
-        json[idx++] = schalter->get_config();
+    if (!is_list) {
+        if (size) {
+            json = schalters[set_members[first]].get_config();
+        }
+        return json;
+    }
+
+    size_t pos = 0;
+    for (uint16_t idx = first; idx < first + size; ++idx) {
+        json[pos++] = schalters[set_members[idx]].get_config();
     }
     return json;
 }
 
+SchalterSet::State SchalterSet::get_state() const {
+    if (!is_list) {
+        return size ? schalters[set_members[first]].get_state() : State::init;
+    }
+    return state;
+}
+
+bool SchalterSet::is_open() const {
+    for (uint16_t idx = first; idx < first + size; ++idx) {
+        if (schalters[set_members[idx]].is_open()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned long SchalterSet::get_switch_time_ms() const {
+    unsigned long ret = 0;
+    for (uint16_t idx = first; idx < first + size; ++idx) {
+        ret = std::max(ret, schalters[set_members[idx]].switch_time_ms);
+    }
+    return ret;
+}
+
+void SchalterSet::set_state(State new_state) {
+    if (state == new_state) {
+        return;
+    }
+    syslog.printf("Schalter %s changing state from %s to %s.\n", str().c_str(),
+                  to_c_str(state), to_c_str(new_state));
+    state = new_state;
+}
+
+void SchalterSet::request(size_t requester, bool requesting) {
+    this->requesting = requesting;
+
+    // elements of a set in error or init state are not activated
+    const bool activate = requesting && (!is_list || is_ok());
+    for (uint16_t idx = first; idx < first + size; ++idx) {
+        schalters[set_members[idx]].set_request(requester, activate);
+    }
+}
+
 void SchalterSet::tick() {
-    std::map<State, size_t> states;
-    const bool activate = has_activation_requests() && is_ok();
+    if (!is_list) {
+        return;
+    }
 
-    for (AbstractSchalter *schalter : schalters) {
-        schalter->tick();
-        states[schalter->get_state()] += 1;
-        schalter->set_request(this, activate);
+    std::map<State, size_t> states;
+    for (uint16_t idx = first; idx < first + size; ++idx) {
+        states[schalters[set_members[idx]].get_state()] += 1;
     }
 
     if (states[State::error]) {
@@ -142,50 +308,105 @@ void SchalterSet::tick() {
         // if any element is in init state (but no errors), we're in init state
         // too
         set_state(State::init);
-    } else if (has_activation_requests() && states[State::active]) {
+    } else if (requesting && states[State::active]) {
         // at least one active element
         set_state(State::active);
-    } else if (!has_activation_requests() &&
-               (states[State::inactive] == schalters.size())) {
+    } else if (!requesting && (states[State::inactive] == size)) {
         // only inactive elements, means we're inactive too
         set_state(State::inactive);
     } else {
         // states are different, we're transitioning
-        set_state(has_activation_requests() ? State::activating
-                                            : State::deactivating);
+        set_state(requesting ? State::activating : State::deactivating);
     }
 }
 
-AbstractSchalter *get_schalter(const String &name) {
-    if (name.length() == 0) {
-        return nullptr;
+SchalterSet get_schalter(const JsonVariantConst & json) {
+    std::vector<uint8_t> elements;
+    collect_schalters(json, elements);
+
+    if (elements.size() > std::numeric_limits<uint8_t>::max() ||
+        set_members.size() + elements.size() >
+            std::numeric_limits<uint16_t>::max()) {
+        syslog.printf("Too many schalters in set, ignoring it.\n");
+        elements.clear();
     }
 
-    for (auto schalter : schalters) {
-        if (schalter->name == name) {
-            return schalter;
-        }
+    const uint16_t first = set_members.size();
+    set_members.insert(set_members.end(), elements.begin(), elements.end());
+
+    return SchalterSet(first, elements.size(), json.is<JsonArrayConst>());
+}
+
+bool SchalterSet::operator==(const SchalterSet & other) const {
+    return (is_list == other.is_list) && (size == other.size) &&
+           std::equal(set_members.begin() + first,
+                      set_members.begin() + first + size,
+                      set_members.begin() + other.first);
+}
+
+std::vector<Schalter> & get_schalters() { return schalters; }
+
+void tick_schalters() {
+    for (auto & schalter : schalters) {
+        schalter.tick();
+    }
+}
+
+void tick_schalter_requests() {
+    for (auto & schalter : schalters) {
+        schalter.tick_request();
     }
+}
 
-    auto schalter = new Schalter(name);
-    schalters.push_back(schalter);
+void clear_schalter_switch_times() {
+    for (auto & schalter : schalters) {
+        schalter.switch_time_ms = 0;
+    }
+}
 
-    return schalter;
+void clear_schalter_requests() {
+    for (auto & schalter : schalters) {
+        schalter.clear_requests();
+    }
 }
 
-AbstractSchalter *get_schalter(const JsonVariantConst &json) {
-    if (json.is<String>()) {
-        return get_schalter(json.as<String>());
-    } else if (json.is<JsonArrayConst>()) {
-        std::list<AbstractSchalter *> elements;
-        for (const JsonVariantConst &value : json.as<JsonArrayConst>()) {
-            AbstractSchalter *element = get_schalter(value);
-            if (element) {
-                elements.push_back(element);
+void compact_schalters(const std::vector<SchalterSet *> & sets) {
+    std::vector<int> new_index(schalters.size(), -1);
+    std::vector<Schalter> new_schalters;
+    std::vector<uint8_t> new_members;
+
+    for (SchalterSet * set : sets) {
+        const uint16_t first = new_members.size();
+        for (uint16_t idx = set->first; idx < set->first + set->size; ++idx) {
+            const uint8_t schalter_idx = set_members[idx];
+            if (new_index[schalter_idx] < 0) {
+                new_index[schalter_idx] = new_schalters.size();
+                new_schalters.push_back(schalters[schalter_idx]);
             }
+            new_members.push_back(new_index[schalter_idx]);
+        }
+        set->first = first;
+    }
+
+    for (size_t idx = 0; idx < schalters.size(); ++idx) {
+        Schalter & schalter = schalters[idx];
+        if (new_index[idx] < 0) {
+            syslog.printf("Removing schalter %s.\n", schalter.str().c_str());
+            // nobody will refresh the request anymore
+            schalter.clear_requests();
+            schalter.publish_request();
+        }
+        if (new_index[idx] != (int)idx) {
+            mqtt.unsubscribe("schalter/" + schalter.name);
+        }
+    }
+
+    schalters.swap(new_schalters);
+    set_members.swap(new_members);
+
+    for (size_t idx = 0; idx < new_index.size(); ++idx) {
+        if ((new_index[idx] >= 0) && (new_index[idx] != (int)idx)) {
+            subscribe(new_index[idx]);
         }
-        return new SchalterSet(elements);
-    } else {
-        return nullptr;
     }
 }
@@ -3,10 +3,13 @@
 #include <ArduinoJson.h>
 #include <PicoUtils.h>
 
-#include <list>
-#include <set>
+#include <bitset>
+#include <cstdint>
+#include <vector>
 
-class AbstractSchalter : public PicoUtils::Tickable {
+#include "arrival.h"
+
+class Schalter {
 public:
     enum class State {
         init = 0,
@@ -17,57 +20,134 @@ public:
         error = -1,
     };
 
-    AbstractSchalter() : state(State::init) {}
+    // Requesters are identified by zone index
+    static constexpr size_t max_requesters = 32;
+    typedef std::bitset<max_requesters> Requesters;
+
+    Schalter(const String & name);
+    String str() const { return name; }
 
-    virtual String str() const = 0;
-    virtual JsonDocument get_config() const = 0;
+    const String name;
+
+    void tick();
+    JsonDocument get_config() const;
+
+    void set_request(size_t requester, bool requesting);
+    void clear_requests();
+    void publish_request();
 
-    void set_request(const void * requester, bool requesting);
+    // Publishes the request if it changed or needs a periodic refresh
+    void tick_request();
 
     State get_state() const { return state; }
     bool is_ok() const { return state != State::error && state != State::init; }
 
+    void update(State new_state);
+
+    // Restores a state saved before a reset
+    void restore(State new_state);
+
+    // True if the valve is active, or has been activating for longer than its
+    // configured switch time, so it can be assumed open before the
+    // confirmation arrives.  A valve still activating after twice the switch
+    // time goes into error state.
+    bool is_open() const;
+
+    // Time the valve needs to open or close, 0 if unknown
+    unsigned long switch_time_ms;
+
+    // Number of tick() calls, for diagnostics
+    uint32_t ticks;
+
+    // Upper bound for the adaptive timeout
+    static const unsigned long timeout = 2 * 60 * 1000;
+
 protected:
-    virtual void set_state(State new_state);
-    bool has_activation_requests() const { return !requesters.empty(); }
+    void set_state(State new_state);
+    bool has_activation_requests() const { return requesters.any(); }
 
-private:
-    std::set<const void *> requesters;
+    Requesters requesters;
     PicoUtils::TimedValue<State> state;
+    PicoUtils::Stopwatch last_update;
+    PicoUtils::TimedValue<bool> last_request;
+    ArrivalEstimator arrivals;
 };
 
-class SchalterSet : public AbstractSchalter {
+// A span of indices into the flat schalter array, owned by a single zone.  If
+// the zone was configured with a list of schalters, the state of the set is
+// aggregated from its elements, otherwise the single element's state is used
+// directly.  Ticking a set only updates its state, requests are forwarded with
+// request().  The elements themselves are ticked by tick_schalters().
+class SchalterSet {
 public:
-    SchalterSet(const std::list<AbstractSchalter *> schalters)
-        : schalters(schalters) {}
+    SchalterSet()
+        : first(0),
+          size(0),
+          is_list(false),
+          requesting(false),
+          state(State::init) {}
+    SchalterSet(uint16_t first, uint8_t size, bool is_list)
+        : first(first),
+          size(size),
+          is_list(is_list),
+          requesting(false),
+          state(State::init) {}
+
+    typedef Schalter::State State;
+
+    explicit operator bool() const { return size > 0; }
+
+    String str() const;
+    JsonDocument get_config() const;
+
+    void tick();
+    void request(size_t requester, bool requesting);
+    State get_state() const;
+    bool is_ok() const { return state != State::error && state != State::init; }
 
-    String str() const override;
-    JsonDocument get_config() const override;
+    // True if any element is open, see Schalter::is_open()
+    bool is_open() const;
+    // Longest switch time of the elements
+    unsigned long get_switch_time_ms() const;
 
-    void tick() override;
+    // Same schalters in the same order
+    bool operator==(const SchalterSet & other) const;
+    bool operator!=(const SchalterSet & other) const {
+        return !(*this == other);
+    }
 
 protected:
-    const std::list<AbstractSchalter *> schalters;
+    void set_state(State new_state);
+
+    uint16_t first;
+    uint8_t size;
+    bool is_list;
+    bool requesting;
+    State state;
+
+    friend void compact_schalters(const std::vector<SchalterSet *> & sets);
 };
 
-class Schalter : public AbstractSchalter {
-public:
-    Schalter(const String & name);
-    String str() const override { return name; }
+const char * to_c_str(const Schalter::State & s);
+SchalterSet get_schalter(const JsonVariantConst & json);
 
-    const String name;
+// Direct access to the flat schalter array
+std::vector<Schalter> & get_schalters();
 
-    void tick() override;
-    JsonDocument get_config() const override;
+// Ticks every schalter exactly once, no matter how many sets share it.
+void tick_schalters();
 
-    void publish_request();
+// Publishes the requests of all schalters, after the zones placed them
+void tick_schalter_requests();
 
-protected:
-    virtual void set_state(State new_state) override;
+// Rebuilds the set member array from the given sets, which are the only ones
+// valid afterwards.  Schalters no longer referenced are turned off and dropped.
+void compact_schalters(const std::vector<SchalterSet *> & sets);
 
-    PicoUtils::Stopwatch last_update;
-    PicoUtils::TimedValue<bool> last_request;
-};
+// Forgets the configured switch times before loading a config, get_schalter()
+// sets them again
+void clear_schalter_switch_times();
 
-const char * to_c_str(const Schalter::State & s);
-AbstractSchalter * get_schalter(const JsonVariantConst & json);
+// Drops all activation requests, used when zone indices change.  Zones request
+// their valves again on the next tick.
+void clear_schalter_requests();
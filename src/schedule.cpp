@@ -0,0 +1,200 @@
+#include "schedule.h"
+
+#include <PicoSyslog.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+
+extern PicoSyslog::Logger syslog;
+
+namespace {
+
+const char * const day_names[] = {"mon", "tue", "wed", "thu",
+                                  "fri", "sat", "sun"};
+
+int parse_day(const char * text, size_t length) {
+    if (length != 3) {
+        return -1;
+    }
+    for (int day = 0; day < 7; ++day) {
+        if (strncasecmp(text, day_names[day], 3) == 0) {
+            return day;
+        }
+    }
+    return -1;
+}
+
+// Parses lists of days and day ranges like "mon-fri,sun" into a bit mask, bit
+// 0 is Monday.  Returns 0 on errors.
+uint8_t parse_days(const char * text) {
+    uint8_t mask = 0;
+    while (*text) {
+        const char * end = text + strcspn(text, ",");
+        const char * dash = strchr(text, '-');
+        if (dash && dash < end) {
+            const int first = parse_day(text, dash - text);
+            const int last = parse_day(dash + 1, end - dash - 1);
+            if (first < 0 || last < 0) {
+                return 0;
+            }
+            // ranges may wrap around, e.g. "fri-mon"
+            for (int day = first;; day = (day + 1) % 7) {
+                mask |= 1 << day;
+                if (day == last) break;
+            }
+        } else {
+            const int day = parse_day(text, end - text);
+            if (day < 0) {
+                return 0;
+            }
+            mask |= 1 << day;
+        }
+        text = *end ? end + 1 : end;
+    }
+    return mask;
+}
+
+// Parses "HH:MM", returns minutes since midnight or -1 on errors
+int parse_time(const char * text) {
+    if (!isdigit(text[0]) || !isdigit(text[1]) || text[2] != ':' ||
+        !isdigit(text[3]) || !isdigit(text[4]) || text[5]) {
+        return -1;
+    }
+    const int hour = (text[0] - '0') * 10 + (text[1] - '0');
+    const int minute = (text[3] - '0') * 10 + (text[4] - '0');
+    if (hour > 23 || minute > 59) {
+        return -1;
+    }
+    return hour * 60 + minute;
+}
+
+}  // namespace
+
+Schedule::Schedule(const JsonVariantConst & json) : Schedule() {
+    for (JsonPairConst days : json.as<JsonObjectConst>()) {
+        const uint8_t day_mask = parse_days(days.key().c_str());
+        if (!day_mask) {
+            syslog.printf("Invalid schedule days '%s'.\n", days.key().c_str());
+            continue;
+        }
+        for (JsonPairConst kv : days.value().as<JsonObjectConst>()) {
+            add(day_mask, kv.key().c_str(),
+                Temperature::from_double(kv.value() | NAN));
+        }
+    }
+
+    // later entries override earlier ones for the same minute
+    std::stable_sort(transitions.begin(), transitions.end(),
+                     [](const Transition & a, const Transition & b) {
+                         return a.minute < b.minute;
+                     });
+    std::reverse(transitions.begin(), transitions.end());
+    transitions.erase(std::unique(transitions.begin(), transitions.end(),
+                                  [](const Transition & a,
+                                     const Transition & b) {
+                                      return a.minute == b.minute;
+                                  }),
+                      transitions.end());
+    std::reverse(transitions.begin(), transitions.end());
+    transitions.shrink_to_fit();
+}
+
+void Schedule::add(uint8_t day_mask, const char * time, Temperature desired) {
+    const int minute = parse_time(time);
+    if (minute < 0 || !desired.is_valid()) {
+        syslog.printf("Invalid schedule entry at '%s'.\n", time);
+        return;
+    }
+    for (uint8_t day = 0; day < 7; ++day) {
+        if (day_mask & (1 << day)) {
+            const uint16_t minute_of_week = day * 24 * 60 + minute;
+            transitions.push_back({minute_of_week, desired});
+        }
+    }
+}
+
+void Schedule::lookup(time_t now) {
+    struct tm tm;
+    localtime_r(&now, &tm);
+
+    const uint16_t minute =
+        ((tm.tm_wday + 6) % 7) * 24 * 60 + tm.tm_hour * 60 + tm.tm_min;
+
+    const auto next_it = std::upper_bound(
+        transitions.begin(), transitions.end(), minute,
+        [](uint16_t m, const Transition & t) { return m < t.minute; });
+
+    // before the first transition of the week, the last one is still active
+    const size_t next = next_it - transitions.begin();
+    current = (next == 0) ? transitions.size() - 1 : next - 1;
+
+    const Transition & upcoming = transitions[next % transitions.size()];
+    uint16_t delta =
+        (upcoming.minute + minutes_per_week - minute) % minutes_per_week;
+    if (!delta) {
+        delta = minutes_per_week;
+    }
+
+    // let mktime work out the DST changes on the way
+    tm.tm_min += delta;
+    tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    deadline = mktime(&tm);
+    if (deadline <= now) {
+        // transition time skipped by a DST change
+        deadline = now + 60;
+    }
+    valid_from = now;
+}
+
+bool Schedule::update(time_t now) {
+    if (transitions.empty()) {
+        return false;
+    }
+
+    if ((current != npos) && (now >= valid_from) && (now < deadline)) {
+        return false;
+    }
+
+    // a transition also fires if it's the same as the previous one, e.g. in
+    // a schedule with a single transition per week, but not if the clock
+    // went back
+    const bool fired = (current != npos) && (now >= deadline);
+    lookup(now);
+    return fired;
+}
+
+bool Schedule::operator==(const Schedule & other) const {
+    return std::equal(transitions.begin(), transitions.end(),
+                      other.transitions.begin(), other.transitions.end(),
+                      [](const Transition & a, const Transition & b) {
+                          return (a.minute == b.minute) &&
+                                 (a.desired == b.desired);
+                      });
+}
+
+Temperature Schedule::get_desired() const {
+    return (current != npos) ? transitions[current].desired
+                             : Temperature::invalid();
+}
+
+Temperature Schedule::get_next_desired() const {
+    return (current != npos)
+               ? transitions[(current + 1) % transitions.size()].desired
+               : Temperature::invalid();
+}
+
+JsonDocument Schedule::get_config() const {
+    JsonDocument json;
+    for (const auto & transition : transitions) {
+        const uint16_t minute_of_day = transition.minute % (24 * 60);
+        char time[6];
+        snprintf(time, sizeof(time), "%02u:%02u", (unsigned)minute_of_day / 60,
+                 (unsigned)minute_of_day % 60);
+        json[day_names[transition.minute / (24 * 60)]][time] =
+            transition.desired.to_double();
+    }
+    return json;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <ArduinoJson.h>
+
+#include <cstdint>
+#include <ctime>
+#include <vector>
+
+#include "temperature.h"
+
+// Weekly setpoint schedule, configured as days and times of transitions:
+//
+//   "schedule": {
+//       "mon-fri": {"06:30": 21, "22:00": 18},
+//       "sat,sun": {"08:00": 21, "23:00": 18}
+//   }
+//
+// The config is compiled into a table of transitions sorted by minute of the
+// week.  The active transition is cached along with the time of the next one,
+// so between transitions a lookup is just a comparison.
+class Schedule {
+public:
+    Schedule() : current(npos), deadline(0), valid_from(0) {}
+    explicit Schedule(const JsonVariantConst & json);
+
+    explicit operator bool() const { return !transitions.empty(); }
+
+    // Advances to the given time.  Returns true if a transition time was
+    // crossed since the previous call.  The first call, e.g. after a restart
+    // or after the clock got synchronized, only finds the active transition.
+    bool update(time_t now);
+
+    // Setpoint of the active transition, only valid after update()
+    Temperature get_desired() const;
+
+    // Time and setpoint of the next transition
+    time_t get_deadline() const { return deadline; }
+    Temperature get_next_desired() const;
+
+    JsonDocument get_config() const;
+
+    // Same transitions, regardless of how they were written in the config
+    bool operator==(const Schedule & other) const;
+    bool operator!=(const Schedule & other) const { return !(*this == other); }
+
+protected:
+    struct Transition {
+        uint16_t minute;  // minutes since Monday 00:00 local time
+        Temperature desired;
+    };
+
+    static const size_t npos = (size_t)-1;
+    static const uint16_t minutes_per_week = 7 * 24 * 60;
+
+    void add(uint8_t day_mask, const char * time, Temperature desired);
+    void lookup(time_t now);
+
+    std::vector<Transition> transitions;
+    size_t current;
+    time_t deadline;
+    time_t valid_from;
+};
@@ -6,6 +6,10 @@
 #include <PicoMQTT.h>
 #include <PicoSyslog.h>
 
+#include <algorithm>
+#include <limits>
+#include <vector>
+
 #include "mqtt.h"
 
 extern PicoSyslog::Logger syslog;
@@ -13,21 +17,82 @@ extern PicoMQ picomq;
 extern MQTTServer mqtt;
 
 namespace {
-std::list<Sensor *> sensors;
+std::vector<Sensor> sensors;
+std::vector<uint8_t> chain_members;
+
+String get_topic(const Sensor & sensor) {
+    return "celsius/+/" + sensor.address + "/temperature";
+}
+
+// Handlers refer to sensors by index, so they're subscribed again whenever the
+// index changes
+void subscribe(uint8_t idx) {
+    const auto handler = [idx](const char *, String payload) {
+        sensors[idx].update(Temperature::parse(payload.c_str()));
+    };
+
+    const String topic = get_topic(sensors[idx]);
+    picomq.subscribe(topic, handler);
+    mqtt.subscribe(topic, handler);
+}
+
+void unsubscribe(const Sensor & sensor) {
+    const String topic = get_topic(sensor);
+    picomq.unsubscribe(topic);
+    mqtt.unsubscribe(topic);
+}
+
+void collect_sensors(const JsonVariantConst & json,
+                     std::vector<uint8_t> & elements) {
+    if (json.is<const char *>()) {
+        const String address = json.as<const char *>();
+
+        for (size_t idx = 0; idx < sensors.size(); ++idx) {
+            if (sensors[idx].address == address) {
+                elements.push_back(idx);
+                return;
+            }
+        }
+
+        if (sensors.size() > std::numeric_limits<uint8_t>::max()) {
+            syslog.printf("Too many sensors, ignoring %s.\n", address.c_str());
+            return;
+        }
+
+        const uint8_t idx = sensors.size();
+        sensors.emplace_back(address);
+        elements.push_back(idx);
+        subscribe(idx);
+    } else if (json.is<JsonArrayConst>()) {
+        // nested chains are flattened, the first member not in error state
+        // wins either way
+        for (const JsonVariantConst & value : json.as<JsonArrayConst>()) {
+            collect_sensors(value, elements);
+        }
+    }
 }
 
-const char * to_c_str(const AbstractSensor::State & s) {
+}  // namespace
+
+const char * to_c_str(const Sensor::State & s) {
     switch (s) {
-        case AbstractSensor::State::init:
+        case Sensor::State::init:
             return "init";
-        case AbstractSensor::State::ok:
+        case Sensor::State::ok:
             return "ok";
         default:
             return "error";
     }
 }
 
-void AbstractSensor::set_state(State new_state) {
+Sensor::Sensor(const String & address)
+    : address(address),
+      ticks(0),
+      state(State::init),
+      reading(Temperature::invalid()),
+      last_update(millis()) {}
+
+void Sensor::set_state(State new_state) {
     if (state == new_state) {
         return;
     }
@@ -36,37 +101,42 @@ void AbstractSensor::set_state(State new_state) {
     state = new_state;
 }
 
-DummySensor::DummySensor() { set_state(State::error); }
-
-void DummySensor::tick() {}
-
-JsonDocument DummySensor::get_config() const {
-    JsonDocument json;
-    return json;
+void Sensor::update(Temperature value) {
+    if (!value.is_valid()) {
+        syslog.printf("Invalid reading from sensor %s.\n", address.c_str());
+        return;
+    }
+    if (state == State::ok) {
+        arrivals.sample(get_age());
+    }
+    reading = value;
+    last_update = millis();
+    Serial.printf("Temperature update for sensor %s: %s ºC\n",
+                  address.c_str(), value.str().c_str());
+    set_state(State::ok);
 }
 
-Sensor::Sensor(const String & address)
-    : address(address), reading(std::numeric_limits<double>::quiet_NaN()) {
-    const String topic = "celsius/+/" + address + "/temperature";
-    const auto handler = [this](const char *, String payload) {
-        reading = payload.toDouble();
-        Serial.printf("Temperature update for sensor %s: %.2f ºC\n",
-                      this->address.c_str(), (double)reading);
-        set_state(State::ok);
-    };
-
-    picomq.subscribe(topic, handler);
-    mqtt.subscribe(topic, handler);
+void Sensor::restore(Temperature value, unsigned long age) {
+    if (!value.is_valid() || (age >= timeout)) {
+        return;
+    }
+    reading = value;
+    last_update = millis() - age;
+    // the age is only saved in whole seconds
+    arrivals.skip_next();
+    set_state(State::ok);
 }
 
 void Sensor::tick() {
-    if (reading.elapsed_millis() >= 5 * 60 * 1000) {
+    ++ticks;
+    if (get_age() >= arrivals.timeout(timeout)) {
         set_state(State::error);
-        reading = std::numeric_limits<double>::quiet_NaN();
+        reading = Temperature::invalid();
+        last_update = millis();
     }
 }
 
-double Sensor::get_reading() const { return reading; }
+Temperature Sensor::get_reading() const { return reading; }
 
 JsonDocument Sensor::get_config() const {
     JsonDocument json;
@@ -74,72 +144,133 @@ JsonDocument Sensor::get_config() const {
     return json;
 }
 
-void SensorChain::tick() {
-    State new_state = State::error;
-    for (AbstractSensor * sensor : sensors) {
-        sensor->tick();
-        if (new_state == State::error) {
-            new_state = sensor->get_state();
+Sensor::State SensorChain::get_state() const {
+    for (uint16_t idx = first; idx < first + size; ++idx) {
+        const Sensor & sensor = sensors[chain_members[idx]];
+        if (sensor.get_state() != Sensor::State::error) {
+            return sensor.get_state();
         }
     }
-    set_state(new_state);
+    return Sensor::State::error;
 }
 
-double SensorChain::get_reading() const {
-    for (AbstractSensor * sensor : sensors) {
-        if (sensor->get_state() == State::ok) {
-            return sensor->get_reading();
+Temperature SensorChain::get_reading() const {
+    for (uint16_t idx = first; idx < first + size; ++idx) {
+        const Sensor & sensor = sensors[chain_members[idx]];
+        if (sensor.get_state() == Sensor::State::ok) {
+            return sensor.get_reading();
         }
     }
-    return std::numeric_limits<double>::quiet_NaN();
+    return Temperature::invalid();
 }
 
 String SensorChain::str() const {
+    if (!is_list) {
+        return size ? sensors[chain_members[first]].str() : "dummy";
+    }
+
     String ret;
-    bool first = true;
-    for (AbstractSensor * sensor : sensors) {
-        if (first) {
-            ret = sensor->str();
-            first = false;
-        } else {
-            ret = ret + ", " + sensor->str();
+    for (uint16_t idx = first; idx < first + size; ++idx) {
+        if (idx != first) {
+            ret += ", ";
         }
-    };
+        ret += sensors[chain_members[idx]].str();
+    }
     return "[" + ret + "]";
 }
 
 JsonDocument SensorChain::get_config() const {
     JsonDocument json;
-    unsigned int idx = 0;
-    for (AbstractSensor * sensor : sensors) {
-        json[idx++] = sensor->get_config();
+    if (!is_list) {
+        if (size) {
+            json = sensors[chain_members[first]].get_config();
+        }
+        return json;
+    }
+
+    unsigned int pos = 0;
+    for (uint16_t idx = first; idx < first + size; ++idx) {
+        json[pos++] = sensors[chain_members[idx]].get_config();
     }
     return json;
 }
 
-AbstractSensor * get_sensor(const JsonVariantConst & json) {
-    if (json.is<const char *>()) {
-        const String address = json.as<const char *>();
+SensorChain get_sensor(const JsonVariantConst & json) {
+    std::vector<uint8_t> elements;
+    collect_sensors(json, elements);
 
-        for (auto sensor : sensors) {
-            if ((sensor->address == address)) {
-                return sensor;
-            }
+    if (elements.size() > std::numeric_limits<uint8_t>::max() ||
+        chain_members.size() + elements.size() >
+            std::numeric_limits<uint16_t>::max()) {
+        syslog.printf("Too many sensors in chain, ignoring it.\n");
+        elements.clear();
+    }
+
+    const uint16_t first = chain_members.size();
+    chain_members.insert(chain_members.end(), elements.begin(), elements.end());
+
+    return SensorChain(first, elements.size(), json.is<JsonArrayConst>());
+}
+
+bool SensorChain::operator==(const SensorChain & other) const {
+    return (is_list == other.is_list) && (size == other.size) &&
+           std::equal(chain_members.begin() + first,
+                      chain_members.begin() + first + size,
+                      chain_members.begin() + other.first);
+}
+
+std::vector<Sensor> & get_sensors() { return sensors; }
+
+bool update_sensor(const String & address, Temperature reading) {
+    for (auto & sensor : sensors) {
+        if (sensor.address == address) {
+            sensor.update(reading);
+            return true;
         }
-        auto sensor = new Sensor(address);
-        sensors.push_back(sensor);
+    }
+    return false;
+}
 
-        return sensor;
-    } else if (json.is<JsonArrayConst>()) {
-        std::list<AbstractSensor *> elements;
-        for (const JsonVariantConst & value : json.as<JsonArrayConst>()) {
-            AbstractSensor * element = get_sensor(value);
-            if (element) {
-                elements.push_back(element);
+void tick_sensors() {
+    for (auto & sensor : sensors) {
+        sensor.tick();
+    }
+}
+
+void compact_sensors(const std::vector<SensorChain *> & chains) {
+    std::vector<int> new_index(sensors.size(), -1);
+    std::vector<Sensor> new_sensors;
+    std::vector<uint8_t> new_members;
+
+    for (SensorChain * chain : chains) {
+        const uint16_t first = new_members.size();
+        for (uint16_t idx = chain->first; idx < chain->first + chain->size;
+             ++idx) {
+            const uint8_t sensor_idx = chain_members[idx];
+            if (new_index[sensor_idx] < 0) {
+                new_index[sensor_idx] = new_sensors.size();
+                new_sensors.push_back(sensors[sensor_idx]);
             }
+            new_members.push_back(new_index[sensor_idx]);
+        }
+        chain->first = first;
+    }
+
+    for (size_t idx = 0; idx < sensors.size(); ++idx) {
+        if (new_index[idx] < 0) {
+            syslog.printf("Removing sensor %s.\n", sensors[idx].str().c_str());
+        }
+        if (new_index[idx] != (int)idx) {
+            unsubscribe(sensors[idx]);
+        }
+    }
+
+    sensors.swap(new_sensors);
+    chain_members.swap(new_members);
+
+    for (size_t idx = 0; idx < new_index.size(); ++idx) {
+        if ((new_index[idx] >= 0) && (new_index[idx] != (int)idx)) {
+            subscribe(new_index[idx]);
         }
-        return new SensorChain(elements);
-    } else {
-        return new DummySensor();
     }
 }
@@ -3,9 +3,13 @@
 #include <ArduinoJson.h>
 #include <PicoUtils.h>
 
-#include <list>
+#include <cstdint>
+#include <vector>
 
-class AbstractSensor : public PicoUtils::Tickable {
+#include "arrival.h"
+#include "temperature.h"
+
+class Sensor {
 public:
     enum class State {
         init = 0,
@@ -13,58 +17,80 @@ public:
         error = -1,
     };
 
-    AbstractSensor() : state(State::init) {}
+    Sensor(const String & address);
 
-    virtual String str() const = 0;
-    virtual double get_reading() const {
-        return std::numeric_limits<double>::quiet_NaN();
-    }
+    void tick();
+    String str() const { return address; }
+    Temperature get_reading() const;
     State get_state() const { return state; }
-    virtual JsonDocument get_config() const = 0;
+    JsonDocument get_config() const;
 
-protected:
-    void set_state(State new_state);
+    void update(Temperature value);
 
-private:
-    State state;
-};
+    // Milliseconds since the last reading
+    unsigned long get_age() const { return millis() - last_update; }
 
-class DummySensor : public AbstractSensor {
-public:
-    DummySensor();
-    void tick() override;
-    virtual String str() const override { return "dummy"; }
-    JsonDocument get_config() const override;
-};
+    // Restores a reading taken age milliseconds ago, e.g. from before a reset
+    void restore(Temperature value, unsigned long age);
 
-class Sensor : public AbstractSensor {
-public:
-    Sensor(const String & address);
+    const String address;
 
-    void tick() override;
-    virtual String str() const override { return address; }
-    double get_reading() const override;
-    JsonDocument get_config() const override;
+    // Number of tick() calls, for diagnostics
+    uint32_t ticks;
 
-    const String address;
+    // Upper bound for the adaptive timeout
+    static const unsigned long timeout = 5 * 60 * 1000;
 
 protected:
-    PicoUtils::TimedValue<double> reading;
+    void set_state(State new_state);
+
+    State state;
+    Temperature reading;
+    unsigned long last_update;
+    ArrivalEstimator arrivals;
 };
 
-class SensorChain : public AbstractSensor {
+// A span of indices into the flat sensor array.  The first member, which is
+// not in error state, determines the state and reading of the whole chain.  An
+// empty chain is always in error state.
+class SensorChain {
 public:
-    SensorChain();
-    SensorChain(const std::list<AbstractSensor *> sensors) : sensors(sensors) {}
-
-    void tick() override;
-    virtual String str() const override;
-    double get_reading() const override;
-    JsonDocument get_config() const override;
+    SensorChain() : first(0), size(0), is_list(false) {}
+    SensorChain(uint16_t first, uint8_t size, bool is_list)
+        : first(first), size(size), is_list(is_list) {}
+
+    String str() const;
+    Temperature get_reading() const;
+    Sensor::State get_state() const;
+    JsonDocument get_config() const;
+
+    // Same sensors in the same order
+    bool operator==(const SensorChain & other) const;
+    bool operator!=(const SensorChain & other) const {
+        return !(*this == other);
+    }
 
 protected:
-    const std::list<AbstractSensor *> sensors;
+    uint16_t first;
+    uint8_t size;
+    bool is_list;
+
+    friend void compact_sensors(const std::vector<SensorChain *> & chains);
 };
 
-const char * to_c_str(const AbstractSensor::State & s);
-AbstractSensor * get_sensor(const JsonVariantConst & json);
+const char * to_c_str(const Sensor::State & s);
+SensorChain get_sensor(const JsonVariantConst & json);
+
+// Direct access to the flat sensor array
+std::vector<Sensor> & get_sensors();
+
+// Feeds a reading obtained by other means than MQTT.  Returns false if no
+// sensor with the given address is configured.
+bool update_sensor(const String & address, Temperature reading);
+
+// Ticks every sensor exactly once, no matter how many chains share it.
+void tick_sensors();
+
+// Rebuilds the chain member array from the given chains, which are the only
+// ones valid afterwards.  Sensors no longer referenced are dropped.
+void compact_sensors(const std::vector<SensorChain *> & chains);
@@ -0,0 +1,222 @@
+#include "snapshot.h"
+
+#include <Arduino.h>
+#include <PicoSyslog.h>
+#include <PicoUtils.h>
+#include <coredecls.h>
+
+#include <cstring>
+#include <vector>
+
+#include "schalter.h"
+#include "sensor.h"
+#include "zone.h"
+
+extern PicoSyslog::Logger syslog;
+extern std::vector<Zone> zones;
+extern PicoUtils::PinOutput heating_relay;
+
+namespace Snapshot {
+
+namespace {
+
+// The first 128 bytes of RTC user memory are used by the OTA bootloader
+const uint32_t rtc_offset = 32;
+const size_t rtc_size = 512 - 128;
+
+// The low half holds the layout version, snapshots of other versions are
+// ignored
+const uint16_t layout_version = 3;
+const uint32_t magic = 0xca100000 | layout_version;
+
+// Records are stored in the order of the zones and schalters, the sensor
+// records carry the sensor index.  They're only restored if the topology hash
+// in the header matches the current config.
+struct Header {
+    uint32_t magic;
+    uint32_t checksum;
+    uint32_t topology;
+    uint16_t size;
+    uint8_t zones;
+    uint8_t sensors;
+    uint8_t schalters;
+    uint8_t relay;
+    uint16_t reserved;
+};
+
+struct ZoneRecord {
+    int8_t state;
+    uint8_t enabled;
+    uint16_t reserved;
+    int32_t desired;  // Temperature units
+    uint32_t boost;   // seconds
+};
+
+struct SensorRecord {
+    int32_t reading;  // Temperature units
+    uint16_t age;     // seconds
+    uint8_t index;
+    uint8_t reserved;
+};
+
+struct SchalterRecord {
+    int8_t state;
+};
+
+uint32_t buffer[rtc_size / 4];
+
+uint32_t hash(const String & text, uint32_t crc) {
+    // include the terminator, so that names can't run into each other
+    return crc32(text.c_str(), text.length() + 1, crc);
+}
+
+// Hash of the zone names, sensor addresses and schalter names in order
+uint32_t topology_hash() {
+    uint32_t crc = 0xffffffff;
+    for (const auto & zone : zones) {
+        crc = hash(zone.name, crc);
+    }
+    crc = hash("", crc);
+    for (const auto & sensor : get_sensors()) {
+        crc = hash(sensor.address, crc);
+    }
+    crc = hash("", crc);
+    for (const auto & schalter : get_schalters()) {
+        crc = hash(schalter.name, crc);
+    }
+    return crc;
+}
+
+uint32_t checksum(const Header & header) {
+    const uint8_t * bytes = (const uint8_t *)buffer;
+    return crc32(bytes + 8, header.size - 8);
+}
+
+template <typename Record>
+bool append(size_t & offset, const Record & record) {
+    if (offset + sizeof(Record) > rtc_size) {
+        return false;
+    }
+    memcpy((uint8_t *)buffer + offset, &record, sizeof(Record));
+    offset += sizeof(Record);
+    return true;
+}
+
+template <typename Record>
+Record read(size_t & offset) {
+    Record record;
+    memcpy(&record, (const uint8_t *)buffer + offset, sizeof(Record));
+    offset += sizeof(Record);
+    return record;
+}
+
+}  // namespace
+
+void save() {
+    Header header = {};
+    header.magic = magic;
+    header.topology = topology_hash();
+    header.relay = heating_relay.get();
+
+    size_t offset = sizeof(Header);
+
+    for (const auto & zone : zones) {
+        ZoneRecord record = {};
+        record.state = (int8_t)zone.get_state();
+        record.enabled = zone.enabled;
+        record.desired = zone.desired.units();
+        record.boost = zone.boost_remaining();
+        if (!append(offset, record)) break;
+        ++header.zones;
+    }
+
+    for (const auto & schalter : get_schalters()) {
+        SchalterRecord record = {};
+        record.state = (int8_t)schalter.get_state();
+        if (!append(offset, record)) break;
+        ++header.schalters;
+    }
+
+    // sensors go last, these are the cheapest to lose if space runs out
+    offset = (offset + 3) & ~3;
+    const auto & sensors = get_sensors();
+    for (size_t idx = 0; idx < sensors.size(); ++idx) {
+        const Sensor & sensor = sensors[idx];
+        if (sensor.get_state() != Sensor::State::ok) {
+            continue;
+        }
+        SensorRecord record = {};
+        record.index = idx;
+        record.reading = sensor.get_reading().units();
+        record.age = std::min(sensor.get_age() / 1000, 0xfffful);
+        if (!append(offset, record)) break;
+        ++header.sensors;
+    }
+
+    header.size = (offset + 3) & ~3;
+    memcpy(buffer, &header, sizeof(Header));
+    header.checksum = checksum(header);
+    memcpy(buffer, &header, sizeof(Header));
+
+    ESP.rtcUserMemoryWrite(rtc_offset, buffer, header.size);
+}
+
+bool restore() {
+    if (!ESP.rtcUserMemoryRead(rtc_offset, buffer, sizeof(Header))) {
+        return false;
+    }
+
+    Header header;
+    memcpy(&header, buffer, sizeof(Header));
+
+    if ((header.magic != magic) || (header.size < sizeof(Header)) ||
+        (header.size > rtc_size) ||
+        !ESP.rtcUserMemoryRead(rtc_offset, buffer, header.size) ||
+        (header.checksum != checksum(header))) {
+        // cold boot, other firmware or corrupted snapshot
+        return false;
+    }
+
+    // invalidate, so that a snapshot is never restored twice
+    uint32_t empty = 0;
+    ESP.rtcUserMemoryWrite(rtc_offset, &empty, sizeof(empty));
+
+    if (header.topology != topology_hash()) {
+        syslog.printf("Snapshot taken with a different config, ignoring.\n");
+        return false;
+    }
+
+    size_t offset = sizeof(Header);
+
+    for (size_t idx = 0; idx < header.zones; ++idx) {
+        const ZoneRecord record = read<ZoneRecord>(offset);
+        zones[idx].restore((Zone::State)record.state, record.enabled,
+                           Temperature::from_units(record.desired),
+                           record.boost);
+    }
+
+    for (size_t idx = 0; idx < header.schalters; ++idx) {
+        const SchalterRecord record = read<SchalterRecord>(offset);
+        const auto state = (Schalter::State)record.state;
+        if (state != Schalter::State::init && state != Schalter::State::error) {
+            get_schalters()[idx].restore(state);
+        }
+    }
+
+    offset = (offset + 3) & ~3;
+    for (size_t i = 0; i < header.sensors; ++i) {
+        const SensorRecord record = read<SensorRecord>(offset);
+        if (record.index < get_sensors().size()) {
+            get_sensors()[record.index].restore(
+                Temperature::from_units(record.reading), record.age * 1000ul);
+        }
+    }
+
+    heating_relay.set(header.relay);
+
+    syslog.printf("Restored %u zones, %u schalters and %u sensors.\n",
+                  header.zones, header.schalters, header.sensors);
+    return true;
+}
+
+}  // namespace Snapshot
@@ -0,0 +1,12 @@
+#pragma once
+
+// Snapshot of the control state kept in RTC memory, which survives software
+// resets.  After a warm reset, zones, sensors, valves and the boiler relay
+// resume from the snapshot instead of waiting for fresh updates.  Restored
+// readings keep their age, so they still time out as usual.
+namespace Snapshot {
+
+void save();
+bool restore();
+
+};  // namespace Snapshot
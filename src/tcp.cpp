@@ -0,0 +1,143 @@
+#include "tcp.h"
+
+#include <algorithm>
+
+TcpClient::TcpClient()
+    : pcb(nullptr),
+      rx(nullptr),
+      rx_offset(0),
+      established(false),
+      peer_closed(false) {}
+
+TcpClient::~TcpClient() { abort(); }
+
+bool TcpClient::connect(const IPAddress & address, uint16_t port) {
+    abort();
+
+    pcb = tcp_new();
+    if (!pcb) {
+        return false;
+    }
+
+    established = false;
+    peer_closed = false;
+    tcp_arg(pcb, this);
+    tcp_err(pcb, on_error);
+    tcp_recv(pcb, on_received);
+
+    if (tcp_connect(pcb, address, port, on_connected) != ERR_OK) {
+        abort();
+        return false;
+    }
+    return true;
+}
+
+size_t TcpClient::read(uint8_t * buffer, size_t size) {
+    size_t read = 0;
+    while (rx && (read < size)) {
+        const size_t chunk = std::min(size - read, rx->len - rx_offset);
+        pbuf_copy_partial(rx, buffer + read, chunk, rx_offset);
+        read += chunk;
+        rx_offset += chunk;
+
+        if (rx_offset >= rx->len) {
+            // drop the consumed buffer, keeping the rest of the chain
+            pbuf * head = rx;
+            rx = rx->next;
+            rx_offset = 0;
+            if (rx) {
+                pbuf_ref(rx);
+            }
+            pbuf_free(head);
+        }
+    }
+
+    if (pcb && read) {
+        tcp_recved(pcb, read);
+    }
+    return read;
+}
+
+bool TcpClient::write(const char * data, size_t size) {
+    if (!pcb || !established || (size > tcp_sndbuf(pcb))) {
+        return false;
+    }
+    if (tcp_write(pcb, data, size, TCP_WRITE_FLAG_COPY) != ERR_OK) {
+        return false;
+    }
+    tcp_output(pcb);
+    return true;
+}
+
+void TcpClient::set_no_delay(bool no_delay) {
+    if (!pcb) {
+        return;
+    }
+    if (no_delay) {
+        tcp_nagle_disable(pcb);
+    } else {
+        tcp_nagle_enable(pcb);
+    }
+}
+
+void TcpClient::stop() {
+    tcp_pcb * old = detach();
+    if (old && (tcp_close(old) != ERR_OK)) {
+        // out of memory, there's no other way to get rid of it
+        tcp_abort(old);
+    }
+    release_rx();
+}
+
+void TcpClient::abort() {
+    tcp_pcb * old = detach();
+    if (old) {
+        tcp_abort(old);
+    }
+    release_rx();
+}
+
+tcp_pcb * TcpClient::detach() {
+    tcp_pcb * old = pcb;
+    if (old) {
+        tcp_arg(old, nullptr);
+        tcp_err(old, nullptr);
+        tcp_recv(old, nullptr);
+    }
+    pcb = nullptr;
+    established = false;
+    return old;
+}
+
+void TcpClient::release_rx() {
+    if (rx) {
+        pbuf_free(rx);
+    }
+    rx = nullptr;
+    rx_offset = 0;
+}
+
+err_t TcpClient::on_connected(void * arg, tcp_pcb *, err_t) {
+    TcpClient * client = static_cast<TcpClient *>(arg);
+    client->established = true;
+    return ERR_OK;
+}
+
+err_t TcpClient::on_received(void * arg, tcp_pcb *, pbuf * p, err_t) {
+    TcpClient * client = static_cast<TcpClient *>(arg);
+    if (!p) {
+        client->peer_closed = true;
+    } else if (client->rx) {
+        pbuf_cat(client->rx, p);
+    } else {
+        client->rx = p;
+    }
+    return ERR_OK;
+}
+
+void TcpClient::on_error(void * arg, err_t) {
+    // lwIP has freed the pcb already
+    TcpClient * client = static_cast<TcpClient *>(arg);
+    client->pcb = nullptr;
+    client->established = false;
+}
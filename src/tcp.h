@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Arduino.h>
+#include <IPAddress.h>
+#include <lwip/tcp.h>
+
+// TCP client on the raw lwIP API.  Unlike WiFiClient::connect(), connect()
+// doesn't wait for the handshake, it returns right away and the outcome shows
+// in connecting() and connected() later.  Received data stays in the buffers
+// lwIP delivered it in until it's read, the receive window only opens as it's
+// read.
+class TcpClient {
+public:
+    TcpClient();
+    ~TcpClient();
+
+    // lwIP callbacks refer to the client by address
+    TcpClient(const TcpClient &) = delete;
+    TcpClient & operator=(const TcpClient &) = delete;
+
+    // Starts connecting, dropping the previous connection if any.  Returns
+    // false if the attempt couldn't be started at all.
+    bool connect(const IPAddress & address, uint16_t port);
+
+    // The handshake is still in progress
+    bool connecting() const { return pcb && !established; }
+
+    // The connection is established and not closed by the peer, or there's
+    // received data left to read
+    bool connected() const {
+        return (pcb && established && !peer_closed) || available();
+    }
+
+    size_t available() const { return rx ? rx->tot_len - rx_offset : 0; }
+    size_t read(uint8_t * buffer, size_t size);
+
+    // Queues data for sending, returns false if it doesn't fit the send buffer
+    bool write(const char * data, size_t size);
+
+    void set_no_delay(bool no_delay);
+
+    // Closes the connection gracefully, unsent data is still delivered
+    void stop();
+    // Resets the connection
+    void abort();
+
+protected:
+    static err_t on_connected(void * arg, tcp_pcb * pcb, err_t err);
+    static err_t on_received(void * arg, tcp_pcb * pcb, pbuf * p, err_t err);
+    static void on_error(void * arg, err_t err);
+
+    tcp_pcb * detach();
+    void release_rx();
+
+    tcp_pcb * pcb;
+    pbuf * rx;
+    size_t rx_offset;
+    bool established;
+    bool peer_closed;
+};
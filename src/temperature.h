@@ -0,0 +1,152 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+
+// Temperature in units of 1/400 of a degree Celsius, so that both hundredths
+// (config, API) and sixteenths (the resolution of DS18B20 sensors) are exact.
+// The ESP8266 has no FPU, so the control path sticks to integer arithmetic and
+// only converts from and to floating point at the edges (JSON, Home
+// Assistant).  The invalid value plays the role NaN used to, it compares false
+// against anything.
+class Temperature {
+public:
+    static constexpr int32_t scale = 400;
+
+    constexpr Temperature() : value(invalid_value) {}
+
+    static constexpr Temperature from_units(int32_t units) {
+        return (units < min_value || units > max_value) ? Temperature()
+                                                         : Temperature(units);
+    }
+
+    static constexpr Temperature from_centi(int16_t centi) {
+        return (centi == std::numeric_limits<int16_t>::min())
+                   ? Temperature()
+                   : Temperature(centi * (scale / 100));
+    }
+
+    static constexpr Temperature invalid() { return Temperature(); }
+
+    static Temperature from_double(double degrees) {
+        if (std::isnan(degrees) || (degrees * scale > max_value) ||
+            (degrees * scale < min_value)) {
+            return invalid();
+        }
+        return Temperature(std::lround(degrees * scale));
+    }
+
+    // Parses a decimal number like "21.0625" without going through floating
+    // point.  Four decimals are exact, further ones are rounded.
+    static Temperature parse(const char * text) {
+        while (*text == ' ') ++text;
+
+        const bool negative = (*text == '-');
+        if (negative || *text == '+') ++text;
+
+        if (!isdigit(*text) && !(text[0] == '.' && isdigit(text[1]))) {
+            return invalid();
+        }
+
+        int32_t degrees = 0;
+        while (isdigit(*text)) {
+            degrees = degrees * 10 + (*text++ - '0');
+            if (degrees * scale > max_value) {
+                return invalid();
+            }
+        }
+
+        // fraction in units of 1/10000
+        int32_t fraction = 0;
+        if (*text == '.') {
+            ++text;
+            int32_t weight = 1000;
+            while (isdigit(*text)) {
+                if (weight >= 1) {
+                    fraction += (*text - '0') * weight;
+                } else if (weight == 0 && *text >= '5') {
+                    // round on the fifth decimal
+                    fraction += 1;
+                }
+                weight = (weight >= 1) ? weight / 10 : -1;
+                ++text;
+            }
+        }
+
+        const int32_t units =
+            degrees * scale + (fraction * scale + 5000) / 10000;
+        if (units > max_value) {
+            return invalid();
+        }
+
+        return Temperature(negative ? -units : units);
+    }
+
+    bool is_valid() const { return value != invalid_value; }
+    int32_t units() const { return value; }
+
+    // Rounded to hundredths, std::numeric_limits<int16_t>::min() if invalid
+    int16_t centi() const {
+        if (!is_valid()) {
+            return std::numeric_limits<int16_t>::min();
+        }
+        const int32_t half = (value < 0) ? -(scale / 200) : (scale / 200);
+        return (value + half) / (scale / 100);
+    }
+
+    double to_double() const {
+        return is_valid() ? (double)value / scale
+                          : std::numeric_limits<double>::quiet_NaN();
+    }
+
+    String str() const {
+        if (!is_valid()) {
+            return "nan";
+        }
+        const int32_t abs_value = value < 0 ? -value : value;
+        // four decimals, the last two only if needed
+        const int32_t fraction = (abs_value % scale) * (10000 / scale);
+        char buffer[12];
+        if (fraction % 100) {
+            snprintf(buffer, sizeof(buffer), ".%04d", (int)fraction);
+        } else {
+            snprintf(buffer, sizeof(buffer), ".%02d", (int)fraction / 100);
+        }
+        return String(value < 0 ? "-" : "") + String(abs_value / scale) +
+               buffer;
+    }
+
+    bool operator==(const Temperature & other) const {
+        return is_valid() && value == other.value;
+    }
+    bool operator!=(const Temperature & other) const {
+        return !(*this == other);
+    }
+    bool operator<(const Temperature & other) const {
+        return is_valid() && other.is_valid() && value < other.value;
+    }
+    bool operator>(const Temperature & other) const { return other < *this; }
+    bool operator<=(const Temperature & other) const {
+        return is_valid() && other.is_valid() && value <= other.value;
+    }
+    bool operator>=(const Temperature & other) const {
+        return other <= *this;
+    }
+
+protected:
+    static constexpr int32_t invalid_value =
+        std::numeric_limits<int32_t>::min();
+    // same range as hundredths in an int16_t
+    static constexpr int32_t max_value =
+        std::numeric_limits<int16_t>::max() * (scale / 100);
+    static constexpr int32_t min_value = -max_value;
+
+    constexpr explicit Temperature(int32_t value) : value(value) {}
+
+    int32_t value;
+};
@@ -0,0 +1,124 @@
+#include "thermal.h"
+
+#include <Arduino.h>
+
+#include <algorithm>
+
+void ThermalModel::Average::sample(int32_t sample) {
+    if (!samples) {
+        value = sample;
+    } else {
+        value += (sample - value) / 4;
+    }
+    if (samples < min_samples) {
+        ++samples;
+    }
+}
+
+ThermalModel::ThermalModel()
+    : heating(false),
+      settled(false),
+      window_start(0),
+      tracking_overshoot(false),
+      stop_time(0) {}
+
+void ThermalModel::update(Temperature reading, bool new_heating) {
+    const unsigned long now = millis();
+
+    if (new_heating != heating) {
+        if (new_heating) {
+            finish_overshoot();
+        } else if (reading.is_valid()) {
+            tracking_overshoot = true;
+            stop_time = now;
+            stop_reading = peak_reading = reading;
+        }
+        heating = new_heating;
+        settled = false;
+        window_reading = Temperature::invalid();
+    }
+
+    if (!reading.is_valid()) {
+        // start over once readings come back
+        settled = false;
+        window_reading = Temperature::invalid();
+        return;
+    }
+
+    if (tracking_overshoot) {
+        peak_reading = std::max(peak_reading, reading);
+        // done once the temperature clearly started to fall
+        if ((now - stop_time >= overshoot_window_ms) ||
+            (reading.centi() + 10 < peak_reading.centi())) {
+            finish_overshoot();
+        }
+    }
+
+    if (!window_reading.is_valid()) {
+        window_start = now;
+        window_reading = reading;
+        return;
+    }
+
+    const unsigned long elapsed = now - window_start;
+    if (elapsed < window_ms) {
+        return;
+    }
+
+    if (settled) {
+        const int32_t change = reading.centi() - window_reading.centi();
+        const int32_t rate = change * 3600 / (int32_t)(elapsed / 1000);
+        (heating ? heating_rate : cooling_rate).sample(rate);
+    }
+
+    settled = true;
+    window_start = now;
+    window_reading = reading;
+}
+
+void ThermalModel::finish_overshoot() {
+    if (!tracking_overshoot) {
+        return;
+    }
+    tracking_overshoot = false;
+    overshoot.sample(
+        std::max<int32_t>(0, peak_reading.centi() - stop_reading.centi()));
+}
+
+long ThermalModel::time_to_target(Temperature reading,
+                                  Temperature target) const {
+    if (!reading.is_valid() || !target.is_valid()) {
+        return -1;
+    }
+
+    const int32_t change = target.centi() - (int32_t)reading.centi();
+    if (change == 0) {
+        return 0;
+    }
+
+    const Average & rate = (change > 0) ? heating_rate : cooling_rate;
+    if (!rate.known() || ((change > 0) != (rate.value > 0))) {
+        // unknown or the temperature isn't moving that way
+        return -1;
+    }
+
+    return change * 3600 / rate.value;
+}
+
+Temperature ThermalModel::get_overshoot() const {
+    return Temperature::from_centi(overshoot.known() ? overshoot.value : 0);
+}
+
+JsonDocument ThermalModel::get_status() const {
+    JsonDocument json;
+    if (heating_rate.known()) {
+        json["heating_rate"] = heating_rate.value / 100.0;
+    }
+    if (cooling_rate.known()) {
+        json["cooling_rate"] = cooling_rate.value / 100.0;
+    }
+    if (overshoot.known()) {
+        json["overshoot"] = overshoot.value / 100.0;
+    }
+    return json;
+}
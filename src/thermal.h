@@ -0,0 +1,64 @@
+#pragma once
+
+#include <ArduinoJson.h>
+
+#include <cstdint>
+
+#include "temperature.h"
+
+// Online estimate of how a zone responds to heating, learned from its readings.
+// Heating and cooling rates are averaged over windows of a few minutes, the
+// first window after switching between heating and cooling is skipped, as it
+// is dominated by the radiator warming up or cooling down.  The overshoot is
+// the rise of temperature observed after heating stops.  Only a handful of
+// values is kept per zone.
+class ThermalModel {
+public:
+    ThermalModel();
+
+    // Feeds the current reading and heat delivery state, called every tick
+    void update(Temperature reading, bool heating);
+
+    // Seconds needed to get from reading to target at the learned rates, or
+    // -1 if unknown
+    long time_to_target(Temperature reading, Temperature target) const;
+
+    // Expected rise of temperature after heating stops
+    Temperature get_overshoot() const;
+
+    JsonDocument get_status() const;
+
+    static const unsigned long window_ms = 10 * 60 * 1000;
+    static const unsigned long overshoot_window_ms = 60 * 60 * 1000;
+
+protected:
+    // Exponentially weighted moving average of integer samples
+    struct Average {
+        Average() : value(0), samples(0) {}
+        void sample(int32_t sample);
+        bool known() const { return samples >= min_samples; }
+
+        static const uint8_t min_samples = 2;
+
+        int32_t value;
+        uint8_t samples;
+    };
+
+    void finish_overshoot();
+
+    // hundredths of a degree per hour
+    Average heating_rate;
+    Average cooling_rate;
+    // hundredths of a degree
+    Average overshoot;
+
+    bool heating;
+    bool settled;
+    unsigned long window_start;
+    Temperature window_reading;
+
+    bool tracking_overshoot;
+    unsigned long stop_time;
+    Temperature stop_reading;
+    Temperature peak_reading;
+};
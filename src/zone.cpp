@@ -5,10 +5,10 @@
 #include <Hash.h>
 #include <PicoSyslog.h>
 
+#include <algorithm>
 #include <cstdint>
 
-#include "schalter.h"
-#include "sensor.h"
+#include "clock.h"
 
 extern PicoSyslog::Logger syslog;
 
@@ -25,40 +25,94 @@ const char * to_c_str(const Zone::State & s) {
     }
 }
 
-Zone::Zone(const String & name, const JsonVariantConst & json)
+Zone::Zone(size_t index, const String & name, const JsonVariantConst & json)
     : name(name),
       enabled(json["enabled"] | true),
-      desired(json["desired"] | 21.0),
-      hysteresis(json["hysteresis"] | 0.5),
+      desired(Temperature::from_double(json["desired"] | 21.0)),
+      hysteresis(Temperature::from_double(json["hysteresis"] | 0.5)),
+      index(index),
       state(State::init),
       sensor(::get_sensor(json["sensor"])),
       valve(::get_schalter(json["valve"])),
-      boost_timeout(0) {}
+      schedule(json["schedule"]),
+      predictive(json["predictive"] | false),
+      anticipating(false),
+      requesting_valve(false),
+      valve_hold_ms(0),
+      boost_timeout_ms(0) {}
 
-void Zone::tick() {
-    sensor->tick();
-    if (valve) {
-        valve->set_request(this, (enabled && (state == State::heat)));
-        valve->tick();
+void Zone::reconfigure(size_t new_index, const JsonVariantConst & json) {
+    index = new_index;
+    enabled = json["enabled"] | true;
+    desired = Temperature::from_double(json["desired"] | 21.0);
+    hysteresis = Temperature::from_double(json["hysteresis"] | 0.5);
+
+    // the spans are compared by their elements, the ones left unused are
+    // dropped by compact_topology()
+    const SensorChain new_sensor = ::get_sensor(json["sensor"]);
+    if (new_sensor != sensor) {
+        syslog.printf("Zone '%s' sensor changed.\n", name.c_str());
+        sensor = new_sensor;
+    }
+
+    const SchalterSet new_valve = ::get_schalter(json["valve"]);
+    if (new_valve != valve) {
+        syslog.printf("Zone '%s' valve changed.\n", name.c_str());
+        valve = new_valve;
     }
 
+    // an unchanged schedule keeps its state, so it doesn't fire again
+    const Schedule new_schedule(json["schedule"]);
+    if (new_schedule != schedule) {
+        syslog.printf("Zone '%s' schedule changed.\n", name.c_str());
+        schedule = new_schedule;
+    }
+    predictive = json["predictive"] | false;
+}
+
+void Zone::tick() {
     auto set_state = [this](State new_state) {
         if (new_state == state) {
             return;
         }
         syslog.printf("Zone '%s' changing state from %s to %s.\n", name.c_str(),
                       to_c_str(state), to_c_str(new_state));
+        if (state == State::heat) {
+            // keep the valve open for a while, so that the boiler can hand
+            // over to valves of other zones which are still opening
+            valve_hold.reset();
+            valve_hold_ms = valve.get_switch_time_ms();
+        }
         state = new_state;
     };
 
-    if (sensor->get_state() == AbstractSensor::State::error ||
-        (valve && valve->get_state() == Schalter::State::error)) {
+    anticipating = false;
+
+    // the valve set aggregates the states of its elements, which were ticked
+    // already
+    if (valve) {
+        valve.tick();
+    }
+
+    // Scheduled setpoints apply at transitions only, changes made in between
+    // (e.g. from Home Assistant) last until the next transition.  Without a
+    // synchronized clock, the last setpoint stays.
+    if (schedule && Clock::synced() && schedule.update(Clock::now())) {
+        desired = schedule.get_desired();
+        syslog.printf("Zone '%s' scheduled setpoint: %s ºC.\n", name.c_str(),
+                      desired.str().c_str());
+    }
+
+    thermal.update(sensor.get_reading(), heat());
+
+    if (sensor.get_state() == Sensor::State::error ||
+        (valve && valve.get_state() == Schalter::State::error)) {
         set_state(State::error);
         return;
     }
 
-    if (sensor->get_state() == AbstractSensor::State::init ||
-        (valve && valve->get_state() == Schalter::State::init)) {
+    if (sensor.get_state() == Sensor::State::init ||
+        (valve && valve.get_state() == Schalter::State::init)) {
         if (state != State::init) {
             set_state(State::init);
         }
@@ -70,9 +124,24 @@ void Zone::tick() {
         return;
     }
 
-    // FSM inputs
-    const bool warm = sensor->get_reading() >= desired + 0.5 * hysteresis;
-    const bool cold = sensor->get_reading() <= desired - 0.5 * hysteresis;
+    // FSM inputs, computed on doubled values to keep half the hysteresis exact
+    const Temperature reading = sensor.get_reading();
+    const Temperature target = get_target();
+    const bool valid =
+        reading.is_valid() && target.is_valid() && hysteresis.is_valid();
+    const int32_t reading_2 = 2 * reading.units();
+    const int32_t target_2 = 2 * target.units();
+
+    // in predictive mode, heating stops early by the expected overshoot, but
+    // not before reaching the target
+    const int32_t coast_2 =
+        predictive ? std::min<int32_t>(2 * thermal.get_overshoot().units(),
+                                       hysteresis.units())
+                   : 0;
+
+    const bool warm =
+        valid && (reading_2 + coast_2 >= target_2 + hysteresis.units());
+    const bool cold = valid && (reading_2 <= target_2 - hysteresis.units());
 
     switch (state) {
         case State::heat:
@@ -81,22 +150,65 @@ void Zone::tick() {
         default:
             set_state(cold ? State::heat : State::wait);
     }
+
+    // open the valve in advance if the zone will need heat within the valve's
+    // switch time
+    const unsigned long switch_time_ms = valve.get_switch_time_ms();
+    if (valid && switch_time_ms && (state == State::wait)) {
+        const Temperature cold_threshold =
+            Temperature::from_units((target_2 - hysteresis.units()) / 2);
+        const long seconds = thermal.time_to_target(reading, cold_threshold);
+        anticipating = (seconds >= 0) &&
+                       ((unsigned long)seconds * 1000 <= switch_time_ms);
+    }
+}
+
+Temperature Zone::get_target() const {
+    if (!predictive || !schedule || !Clock::synced()) {
+        return desired;
+    }
+
+    // start heating early if that's needed to reach the next scheduled
+    // setpoint on time
+    const Temperature next = schedule.get_next_desired();
+    if (!(next > desired)) {
+        return desired;
+    }
+    const long needed = thermal.time_to_target(get_reading(), next);
+    const long remaining = schedule.get_deadline() - Clock::now();
+    return ((needed >= 0) && (remaining <= needed)) ? next : desired;
 }
 
-bool Zone::heat() const {
-    return enabled && (state == State::heat) &&
-           (!valve || (valve->get_state() == Schalter::State::active));
+void Zone::tick_valve() {
+    requesting_valve =
+        enabled && ((state == State::heat) || anticipating ||
+                    (valve_hold.elapsed_millis() < valve_hold_ms));
+    if (valve) {
+        valve.request(index, requesting_valve);
+    }
 }
 
+bool Zone::demand() const { return enabled && (state == State::heat); }
+
+bool Zone::flow() const {
+    return valve ? (requesting_valve && valve.is_open()) : demand();
+}
+
+bool Zone::heat() const { return demand() && (!valve || valve.is_open()); }
+
 JsonDocument Zone::get_config() const {
     JsonDocument json;
 
-    json["desired"] = desired;
-    json["hysteresis"] = hysteresis;
-    json["sensor"] = sensor->get_config();
+    json["desired"] = desired.to_double();
+    json["hysteresis"] = hysteresis.to_double();
+    json["sensor"] = sensor.get_config();
     if (valve) {
-        json["valve"] = valve->get_config();
+        json["valve"] = valve.get_config();
     }
+    if (schedule) {
+        json["schedule"] = schedule.get_config();
+    }
+    json["predictive"] = predictive;
     json["enabled"] = enabled;
 
     return json;
@@ -105,20 +217,89 @@ JsonDocument Zone::get_config() const {
 JsonDocument Zone::get_status() const {
     JsonDocument json;
 
-    json["desired"] = desired;
-    json["hysteresis"] = hysteresis;
+    json["desired"] = desired.to_double();
+    json["hysteresis"] = hysteresis.to_double();
     json["enabled"] = enabled;
-    json["reading"] = get_reading();
+    json["reading"] = get_reading().to_double();
     json["state"] = to_c_str(state);
-    json["sensor"] = to_c_str(sensor->get_state());
+    json["sensor"] = to_c_str(sensor.get_state());
     json["boost"] = boost_active();
     if (valve) {
-        json["valve"] = to_c_str(valve->get_state());
+        json["valve"] = to_c_str(valve.get_state());
+        json["valve_open"] = valve.is_open();
+    }
+    if (schedule && Clock::synced()) {
+        json["next_transition"] = schedule.get_deadline() - Clock::now();
     }
+    json["target"] = get_target().to_double();
+    const long time_to_target = thermal.time_to_target(get_reading(), desired);
+    if (time_to_target >= 0) {
+        json["time_to_target"] = time_to_target;
+    }
+    json["thermal"] = thermal.get_status();
 
     return json;
 }
 
+const char * Zone::validate_update(const JsonVariantConst & json) {
+    if (!json.is<JsonObjectConst>()) {
+        return "zone update must be an object";
+    }
+
+    for (JsonPairConst kv : json.as<JsonObjectConst>()) {
+        const String key = kv.key().c_str();
+        const JsonVariantConst value = kv.value();
+
+        if (key == "desired") {
+            if (!value.is<double>()) {
+                return "desired must be a number";
+            }
+            const Temperature desired =
+                Temperature::from_double(value.as<double>());
+            if (!(desired >= min_desired && desired <= max_desired)) {
+                return "desired out of range";
+            }
+        } else if (key == "enabled") {
+            if (!value.is<bool>()) {
+                return "enabled must be a boolean";
+            }
+        } else if (key == "boost") {
+            if (!value.is<bool>() &&
+                !(value.is<double>() && value.as<double>() >= 0)) {
+                return "boost must be a boolean or a non-negative timeout";
+            }
+            if (value.is<double>() && value.as<double>() > max_boost_seconds) {
+                return "boost timeout out of range";
+            }
+        } else {
+            return "unsupported zone property";
+        }
+    }
+
+    return nullptr;
+}
+
+void Zone::update(const JsonVariantConst & json) {
+    if (json["desired"].is<double>()) {
+        desired = Temperature::from_double(json["desired"]);
+    }
+
+    if (json["enabled"].is<bool>()) {
+        enabled = json["enabled"];
+    }
+
+    const JsonVariantConst boost_json = json["boost"];
+    if (boost_json.is<bool>()) {
+        if (boost_json.as<bool>()) {
+            boost();
+        } else {
+            boost(0);
+        }
+    } else if (boost_json.is<double>()) {
+        boost(boost_json.as<unsigned long>());
+    }
+}
+
 String Zone::unique_id() const {
     // TODO: Cache this?
     return sha1(String(name)).substring(0, 7);
@@ -126,15 +307,95 @@ String Zone::unique_id() const {
 
 bool Zone::healthcheck() const { return state != State::error; }
 
-void Zone::boost(double timeout_seconds) {
+void Zone::boost(unsigned long timeout_seconds) {
     boost_stopwatch.reset();
-    boost_timeout = timeout_seconds;
+    boost_timeout_ms = std::min(timeout_seconds, max_boost_seconds) * 1000;
 }
 
 bool Zone::boost_active() const {
-    return boost_stopwatch.elapsed() < boost_timeout;
+    return boost_stopwatch.elapsed_millis() < boost_timeout_ms;
 }
 
-double Zone::get_reading() const { return sensor->get_reading(); }
+unsigned long Zone::boost_remaining() const {
+    return boost_active()
+               ? (boost_timeout_ms - boost_stopwatch.elapsed_millis()) / 1000
+               : 0;
+}
+
+void Zone::restore(State new_state, bool new_enabled, Temperature new_desired,
+                   unsigned long boost_seconds) {
+    if ((new_state == State::heat) || (new_state == State::wait)) {
+        state = new_state;
+    }
+    enabled = new_enabled;
+    if (new_desired.is_valid()) {
+        desired = new_desired;
+    }
+    if (boost_seconds) {
+        boost(boost_seconds);
+    }
+    syslog.printf("Zone '%s' restored in state %s.\n", name.c_str(),
+                  to_c_str(state));
+}
+
+Temperature Zone::get_reading() const { return sensor.get_reading(); }
 
 Zone::State Zone::get_state() const { return state; }
+
+void tick_topology(std::vector<Zone> & zones) {
+    tick_sensors();
+    tick_schalters();
+    for (auto & zone : zones) {
+        zone.tick();
+    }
+    for (auto & zone : zones) {
+        zone.tick_valve();
+    }
+    tick_schalter_requests();
+}
+
+void compact_topology(std::vector<Zone> & zones) {
+    std::vector<SensorChain *> chains;
+    std::vector<SchalterSet *> sets;
+    for (auto & zone : zones) {
+        chains.push_back(&zone.sensor);
+        sets.push_back(&zone.valve);
+    }
+    compact_sensors(chains);
+    compact_schalters(sets);
+}
+
+void load_zones(std::vector<Zone> & zones, const JsonObjectConst & config) {
+    std::vector<Zone> new_zones;
+    new_zones.reserve(config.size());
+
+    // schalters shared by several zones take the longest switch time any of
+    // them configures
+    clear_schalter_switch_times();
+
+    for (JsonPairConst kv : config) {
+        if (new_zones.size() >= Schalter::max_requesters) {
+            syslog.printf("Too many zones, ignoring zone '%s'.\n",
+                          kv.key().c_str());
+            continue;
+        }
+
+        const String name = kv.key().c_str();
+        const auto it =
+            std::find_if(zones.begin(), zones.end(),
+                         [&name](const Zone & z) { return z.name == name; });
+        if (it != zones.end()) {
+            new_zones.emplace_back(std::move(*it));
+            new_zones.back().reconfigure(new_zones.size() - 1, kv.value());
+        } else {
+            syslog.printf("Adding zone '%s'.\n", name.c_str());
+            new_zones.emplace_back(new_zones.size(), name, kv.value());
+        }
+    }
+
+    // zone indices may have changed, zones will request their valves again on
+    // the next tick
+    clear_schalter_requests();
+    compact_topology(new_zones);
+    zones.swap(new_zones);
+}
@@ -3,8 +3,13 @@
 #include <ArduinoJson.h>
 #include <PicoUtils.h>
 
-class AbstractSchalter;
-class AbstractSensor;
+#include <vector>
+
+#include "schalter.h"
+#include "schedule.h"
+#include "sensor.h"
+#include "temperature.h"
+#include "thermal.h"
 
 class Zone : public PicoUtils::Tickable {
 public:
@@ -15,37 +20,99 @@ public:
         error = -1,
     };
 
-    Zone(const String & name, const JsonVariantConst & json);
+    Zone(size_t index, const String & name, const JsonVariantConst & json);
+    Zone(Zone &&) = default;
     Zone(const Zone &) = delete;
     Zone & operator=(const Zone &) = delete;
 
     void tick();
+    void tick_valve();
+
+    // The zone wants heat
+    bool demand() const;
+    // The zone's valve is requested and open (or assumed open after its switch
+    // time), so the boiler can safely run
+    bool flow() const;
+    // The zone wants heat and its valve is open
     bool heat() const;
 
     JsonDocument get_config() const;
     JsonDocument get_status() const;
-    double get_reading() const;
+
+    // Changes to desired, enabled and boost as accepted by the REST API.
+    // validate_update returns an error message or nullptr if the update can be
+    // applied safely.
+    static const char * validate_update(const JsonVariantConst & json);
+    void update(const JsonVariantConst & json);
+
+    // Applies a new configuration to an existing zone, keeping its runtime
+    // state.  Sensors and valves are only replaced if their config changed.
+    void reconfigure(size_t index, const JsonVariantConst & json);
+
+    Temperature get_reading() const;
     State get_state() const;
 
+    // Setpoint the zone is currently controlled to, normally the desired
+    // temperature.  In predictive mode, the next scheduled setpoint once
+    // heating must start to reach it on time.
+    Temperature get_target() const;
+
     String unique_id() const;
     bool healthcheck() const;
 
-    void boost(double timeout_seconds = 60 * 60);
+    void boost(unsigned long timeout_seconds = 60 * 60);
     bool boost_active() const;
+    unsigned long boost_remaining() const;
+
+    // Resumes from a state saved before a reset
+    void restore(State state, bool enabled, Temperature desired,
+                 unsigned long boost_seconds);
 
-    const AbstractSensor * get_sensor() const { return sensor; }
-    const AbstractSchalter * get_valve() const { return valve; }
+    const SensorChain & get_sensor() const { return sensor; }
+    const SchalterSet & get_valve() const { return valve; }
+
+    static constexpr Temperature min_desired = Temperature::from_centi(700);
+    static constexpr Temperature max_desired = Temperature::from_centi(2500);
+
+    // Keeps boost timeouts well within the range of millis()
+    static constexpr unsigned long max_boost_seconds = 7 * 24 * 60 * 60;
 
     const String name;
     bool enabled;
-    double desired;
-    const double hysteresis;
+    Temperature desired;
+    Temperature hysteresis;
 
 private:
+    size_t index;
     State state;
-    AbstractSensor * sensor;
-    AbstractSchalter * valve;
+    SensorChain sensor;
+    SchalterSet valve;
+    Schedule schedule;
+    ThermalModel thermal;
+    bool predictive;
 
-    double boost_timeout;
+    bool anticipating;
+    bool requesting_valve;
+    unsigned long valve_hold_ms;
+    PicoUtils::Stopwatch valve_hold;
+
+    unsigned long boost_timeout_ms;
     PicoUtils::Stopwatch boost_stopwatch;
+
+    friend void compact_topology(std::vector<Zone> & zones);
 };
+
+// Evaluates the topology in dependency order: sensors and schalters first, then
+// the zones, which tick their schalter sets before reading them, and finally
+// the requests the zones placed are published.  Every node is ticked exactly
+// once per cycle, regardless of how many zones share it.
+void tick_topology(std::vector<Zone> & zones);
+
+// Drops the sensors, schalters and member array entries not used by the given
+// zones, which must be the complete set.  Called after loading a new config.
+void compact_topology(std::vector<Zone> & zones);
+
+// Builds zones from config.  Zones which already exist keep their runtime
+// state, sensors and valves are shared with the previous topology where
+// possible.
+void load_zones(std::vector<Zone> & zones, const JsonObjectConst & config);
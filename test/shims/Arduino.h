@@ -0,0 +1,249 @@
+#pragma once
+
+// Minimal host replacement of the ESP8266 Arduino core for the native test
+// environment.  Time only advances when a test calls Fake::advance().
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <strings.h>
+
+#define PROGMEM
+#define F(x) (x)
+#define FPSTR(x) (x)
+#define PSTR(x) (x)
+
+namespace Fake {
+
+inline unsigned long now_us = 0;
+
+// RTC user memory, kept across ESP.reset() like on the device
+inline uint8_t rtc_memory[512];
+
+inline void advance(unsigned long ms) { now_us += ms * 1000; }
+inline void advance_us(unsigned long us) { now_us += us; }
+
+}  // namespace Fake
+
+inline unsigned long millis() { return Fake::now_us / 1000; }
+inline unsigned long micros() { return Fake::now_us; }
+inline void delay(unsigned long ms) { Fake::advance(ms); }
+inline void yield() {}
+
+class String {
+public:
+    String() {}
+    String(const char * text) : value(text ? text : "") {}
+    String(const std::string & text) : value(text) {}
+    String(char c) : value(1, c) {}
+    String(int v) : value(std::to_string(v)) {}
+    String(unsigned int v) : value(std::to_string(v)) {}
+    String(long v) : value(std::to_string(v)) {}
+    String(unsigned long v) : value(std::to_string(v)) {}
+
+    String & operator=(const char * text) {
+        value = text ? text : "";
+        return *this;
+    }
+
+    const char * c_str() const { return value.c_str(); }
+    unsigned int length() const { return value.size(); }
+    bool isEmpty() const { return value.empty(); }
+    bool reserve(unsigned int size) {
+        value.reserve(size);
+        return true;
+    }
+
+    bool concat(const char * text) {
+        value += text;
+        return true;
+    }
+    bool concat(const char * text, unsigned int size) {
+        value.append(text, size);
+        return true;
+    }
+
+    String & operator+=(const String & other) {
+        value += other.value;
+        return *this;
+    }
+    String & operator+=(const char * text) {
+        value += text;
+        return *this;
+    }
+    String & operator+=(char c) {
+        value += c;
+        return *this;
+    }
+
+    char operator[](unsigned int idx) const { return value[idx]; }
+    char charAt(unsigned int idx) const { return value[idx]; }
+
+    bool operator==(const String & other) const { return value == other.value; }
+    bool operator==(const char * text) const { return value == text; }
+    bool operator!=(const String & other) const { return value != other.value; }
+    bool operator!=(const char * text) const { return value != text; }
+    bool operator<(const String & other) const { return value < other.value; }
+
+    String substring(unsigned int from) const {
+        return from < value.size() ? value.substr(from) : std::string();
+    }
+    String substring(unsigned int from, unsigned int to) const {
+        return from < value.size() ? value.substr(from, to - from)
+                                   : std::string();
+    }
+
+    int indexOf(char c, unsigned int from = 0) const {
+        const size_t pos = value.find(c, from);
+        return pos == std::string::npos ? -1 : pos;
+    }
+    int indexOf(const char * text, unsigned int from = 0) const {
+        const size_t pos = value.find(text, from);
+        return pos == std::string::npos ? -1 : pos;
+    }
+
+    bool startsWith(const String & prefix) const {
+        return value.compare(0, prefix.value.size(), prefix.value) == 0;
+    }
+
+    long toInt() const { return strtol(value.c_str(), nullptr, 10); }
+    double toDouble() const { return strtod(value.c_str(), nullptr); }
+
+    void trim() {
+        const size_t first = value.find_first_not_of(" \t\r\n");
+        const size_t last = value.find_last_not_of(" \t\r\n");
+        value = (first == std::string::npos)
+                    ? std::string()
+                    : value.substr(first, last - first + 1);
+    }
+
+    void toLowerCase() {
+        for (auto & c : value) c = tolower(c);
+    }
+
+    friend String operator+(const String & a, const String & b) {
+        return a.value + b.value;
+    }
+    friend String operator+(const char * a, const String & b) {
+        return a + b.value;
+    }
+    friend String operator+(const String & a, const char * b) {
+        return a.value + b;
+    }
+
+protected:
+    std::string value;
+};
+
+// ArduinoJson expects this type next to String
+class StringSumHelper : public String {};
+
+class Print {
+public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t c) { return write(&c, 1); }
+    virtual size_t write(const uint8_t * buffer, size_t size) {
+        if (getenv("VERBOSE")) fwrite(buffer, 1, size, stdout);
+        return size;
+    }
+
+    size_t print(const char * text) {
+        return write((const uint8_t *)text, strlen(text));
+    }
+    size_t print(const String & text) { return print(text.c_str()); }
+    size_t println(const char * text = "") { return print(text) + print("\n"); }
+    size_t println(const String & text) { return println(text.c_str()); }
+
+    size_t printf(const char * format, ...)
+        __attribute__((format(printf, 2, 3))) {
+        char buffer[256];
+        va_list args;
+        va_start(args, format);
+        const int size = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        return write((const uint8_t *)buffer,
+                     std::min<size_t>(size, sizeof(buffer) - 1));
+    }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+};
+
+inline Print Serial;
+
+struct ip_addr_t {
+    uint32_t addr;
+};
+
+class IPAddress {
+public:
+    IPAddress() : ip{0} {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+        : ip{a | (b << 8) | (c << 16) | ((uint32_t)d << 24)} {}
+    IPAddress(const ip_addr_t * ip) : ip(*ip) {}
+
+    bool fromString(const char * text) {
+        unsigned int a, b, c, d;
+        char end;
+        if (sscanf(text, "%u.%u.%u.%u%c", &a, &b, &c, &d, &end) != 4 ||
+            a > 255 || b > 255 || c > 255 || d > 255) {
+            return false;
+        }
+        *this = IPAddress(a, b, c, d);
+        return true;
+    }
+
+    bool isSet() const { return ip.addr != 0; }
+    String toString() const {
+        char buffer[16];
+        snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", ip.addr & 0xff,
+                 (ip.addr >> 8) & 0xff, (ip.addr >> 16) & 0xff,
+                 ip.addr >> 24);
+        return buffer;
+    }
+    bool operator==(const IPAddress & other) const {
+        return ip.addr == other.ip.addr;
+    }
+
+    operator const ip_addr_t *() const { return &ip; }
+
+protected:
+    ip_addr_t ip;
+};
+
+struct EspClass {
+    uint32_t getFreeHeap() { return 40000; }
+    uint16_t getMaxFreeBlockSize() { return 30000; }
+    void reset() {}
+
+    // offset is in 4 byte blocks, size in bytes
+    bool rtcUserMemoryRead(uint32_t offset, uint32_t * data, size_t size) {
+        if (!size || (offset * 4 + size > sizeof(Fake::rtc_memory))) {
+            return false;
+        }
+        memcpy(data, Fake::rtc_memory + offset * 4, size);
+        return true;
+    }
+    bool rtcUserMemoryWrite(uint32_t offset, uint32_t * data, size_t size) {
+        if (!size || (offset * 4 + size > sizeof(Fake::rtc_memory))) {
+            return false;
+        }
+        memcpy(Fake::rtc_memory + offset * 4, data, size);
+        return true;
+    }
+};
+
+inline EspClass ESP;
+
+inline void configTime(const char *, const char *) {}
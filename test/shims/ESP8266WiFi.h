@@ -0,0 +1,14 @@
+#pragma once
+
+// WiFi is always connected in the native tests, the fake network is in
+// lwip/tcp.h
+
+#include <Arduino.h>
+
+enum wl_status_t { WL_CONNECTED = 3, WL_DISCONNECTED = 6 };
+
+struct WiFiClass {
+    wl_status_t status() { return WL_CONNECTED; }
+};
+
+inline WiFiClass WiFi;
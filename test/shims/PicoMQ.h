@@ -0,0 +1,15 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <functional>
+
+class PicoMQ {
+public:
+    void begin() {}
+    void loop() {}
+    void subscribe(const String &,
+                   std::function<void(const char *, String)>) {}
+    void unsubscribe(const String &) {}
+    void publish(const String &, const String &) {}
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+// In-process stand-ins for the PicoMQTT broker and client.  Messages published
+// by the code under test are recorded, tests inject incoming messages with
+// deliver().
+
+#include <Arduino.h>
+
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace PicoMQTT {
+
+class IncomingPacket : public Stream {
+public:
+    IncomingPacket(const String & payload) : payload(payload) {}
+    size_t get_remaining_size() const { return payload.length(); }
+
+    const String payload;
+};
+
+class Base {
+public:
+    typedef std::function<void(const char *, const String &)> Handler;
+
+    virtual ~Base() {}
+
+    void begin() {}
+    void loop() {}
+
+    template <typename F>
+    void subscribe(const String & filter, F handler) {
+        if constexpr (std::is_invocable_v<F, const String &>) {
+            subscriptions.push_back(
+                {filter, [handler](const char *, const String & payload) {
+                     handler(payload);
+                 }});
+        } else {
+            subscriptions.push_back(
+                {filter, [handler](const char * topic, const String & payload) {
+                     handler(topic, payload);
+                 }});
+        }
+    }
+
+    void unsubscribe(const String & filter) {
+        for (auto it = subscriptions.begin(); it != subscriptions.end();) {
+            it = (it->first == filter) ? subscriptions.erase(it) : it + 1;
+        }
+    }
+
+    bool publish(const String & topic, const String & payload) {
+        published.push_back({topic, payload});
+        return true;
+    }
+
+    // Delivers a message from a client to the local subscribers
+    void deliver(const String & topic, const String & payload) {
+        IncomingPacket packet(payload);
+        on_message(topic.c_str(), packet);
+    }
+
+    std::vector<std::pair<String, String>> published;
+    std::vector<std::pair<String, Handler>> subscriptions;
+
+protected:
+    virtual void on_message(const char * topic, IncomingPacket & packet) {
+        for (const auto & subscription : subscriptions) {
+            if (matches(subscription.first.c_str(), topic)) {
+                subscription.second(topic, packet.payload);
+            }
+        }
+    }
+
+    static bool matches(const char * filter, const char * topic) {
+        while (*filter) {
+            if (*filter == '#') {
+                return true;
+            } else if (*filter == '+') {
+                while (*topic && *topic != '/') ++topic;
+                ++filter;
+            } else if (*filter++ != *topic++) {
+                return false;
+            }
+        }
+        return !*topic;
+    }
+};
+
+class Server : public Base {
+protected:
+    virtual void on_connected(const char *) {}
+    virtual void on_disconnected(const char *) {}
+    virtual void on_subscribe(const char *, const char *) {}
+    virtual void on_unsubscribe(const char *, const char *) {}
+};
+
+class Client : public Base {
+public:
+    bool connected() const { return is_connected; }
+    void disconnect() { is_connected = false; }
+
+    String host;
+    uint16_t port = 1883;
+    String username;
+    String password;
+
+    // set by tests
+    bool is_connected = false;
+};
+
+}  // namespace PicoMQTT
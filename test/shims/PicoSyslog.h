@@ -0,0 +1,15 @@
+#pragma once
+
+#include <Arduino.h>
+
+namespace PicoSyslog {
+
+class Logger : public Print {
+public:
+    Logger(const char * app_name) : app_name(app_name) {}
+
+    const char * const app_name;
+    String server;
+};
+
+}  // namespace PicoSyslog
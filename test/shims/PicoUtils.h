@@ -0,0 +1,56 @@
+#pragma once
+
+// The parts of PicoUtils used by the tested modules
+
+#include <Arduino.h>
+
+namespace PicoUtils {
+
+class Tickable {
+public:
+    virtual ~Tickable() {}
+    virtual void tick() = 0;
+};
+
+class Stopwatch {
+public:
+    Stopwatch() { reset(); }
+    void reset() { start = millis(); }
+    unsigned long elapsed_millis() const { return millis() - start; }
+    double elapsed() const { return elapsed_millis() / 1000.0; }
+
+protected:
+    unsigned long start;
+};
+
+template <typename T>
+class TimedValue {
+public:
+    TimedValue(const T & value) : value(value) {}
+
+    TimedValue & operator=(const T & new_value) {
+        value = new_value;
+        stopwatch.reset();
+        return *this;
+    }
+
+    operator T() const { return value; }
+    unsigned long elapsed_millis() const { return stopwatch.elapsed_millis(); }
+    double elapsed() const { return stopwatch.elapsed(); }
+
+protected:
+    T value;
+    Stopwatch stopwatch;
+};
+
+class PinOutput {
+public:
+    PinOutput(uint8_t pin, bool inverted = false) : value(false) {}
+    void set(bool new_value) { value = new_value; }
+    bool get() const { return value; }
+
+protected:
+    bool value;
+};
+
+}  // namespace PicoUtils
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <functional>
+
+inline void settimeofday_cb(const std::function<void()> &) {}
+
+inline uint32_t crc32(const void * data, size_t length,
+                      uint32_t crc = 0xffffffff) {
+    const uint8_t * bytes = (const uint8_t *)data;
+    while (length--) {
+        crc ^= *bytes++;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+        }
+    }
+    return crc;
+}
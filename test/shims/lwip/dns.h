@@ -0,0 +1,29 @@
+#pragma once
+
+// Host names resolve through the Fake::hosts table, immediately, as if they
+// were found in lwIP's cache
+
+#include <Arduino.h>
+#include <lwip/err.h>
+
+#include <map>
+#include <string>
+
+typedef void (*dns_found_callback)(const char * name, const ip_addr_t * ipaddr,
+                                   void * callback_arg);
+
+namespace Fake {
+
+inline std::map<std::string, ip_addr_t> hosts;
+
+}  // namespace Fake
+
+inline err_t dns_gethostbyname(const char * name, ip_addr_t * addr,
+                               dns_found_callback, void *) {
+    const auto it = Fake::hosts.find(name);
+    if (it == Fake::hosts.end()) {
+        return ERR_ARG;
+    }
+    *addr = it->second;
+    return ERR_OK;
+}
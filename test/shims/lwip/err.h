@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+typedef int8_t err_t;
+enum {
+    ERR_OK = 0,
+    ERR_MEM = -1,
+    ERR_INPROGRESS = -5,
+    ERR_CONN = -11,
+    ERR_ABRT = -13,
+    ERR_RST = -14,
+    ERR_ARG = -16,
+};
@@ -0,0 +1,230 @@
+#pragma once
+
+// Fake lwIP TCP for the native tests.  Connection attempts are handed to
+// Fake::accept, where a test plays the server side by reading what the client
+// sent and queueing the response.  Like on the device, callbacks never
+// interrupt the client code, they run from Fake::poll(), which stands for lwIP
+// processing between loop() iterations.
+
+#include <Arduino.h>
+#include <lwip/err.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Fake {
+
+struct Connection {
+    IPAddress address;
+    uint16_t port;
+
+    std::string sent;      // written by the client
+    std::string received;  // queued for the client to read
+
+    bool peer_closed = false;
+    bool stopped = false;  // closed gracefully by the client
+    bool aborted = false;  // reset by the client
+};
+
+// Returns false to refuse the connection
+inline std::function<bool(std::shared_ptr<Connection>)> accept;
+
+// Connection attempts to these addresses are never answered
+inline std::vector<IPAddress> unreachable;
+
+}  // namespace Fake
+
+struct pbuf {
+    pbuf * next;
+    void * payload;
+    uint16_t tot_len;
+    uint16_t len;
+    int ref;
+};
+
+struct tcp_pcb;
+
+typedef err_t (*tcp_connected_fn)(void * arg, tcp_pcb * tpcb, err_t err);
+typedef err_t (*tcp_recv_fn)(void * arg, tcp_pcb * tpcb, pbuf * p, err_t err);
+typedef void (*tcp_err_fn)(void * arg, err_t err);
+
+struct tcp_pcb {
+    std::shared_ptr<Fake::Connection> connection;
+    void * arg = nullptr;
+    tcp_connected_fn connected = nullptr;
+    tcp_recv_fn recv = nullptr;
+    tcp_err_fn err = nullptr;
+    bool established = false;
+    bool fin_delivered = false;
+};
+
+#define TCP_WRITE_FLAG_COPY 0x01
+
+namespace Fake {
+
+inline std::vector<tcp_pcb *> pcbs;
+
+inline void release(tcp_pcb * pcb) {
+    pcbs.erase(std::find(pcbs.begin(), pcbs.end(), pcb));
+    delete pcb;
+}
+
+inline pbuf * make_pbuf(const std::string & data) {
+    pbuf * p = new pbuf();
+    p->payload = new char[data.size()];
+    memcpy(p->payload, data.data(), data.size());
+    p->tot_len = p->len = data.size();
+    p->ref = 1;
+    return p;
+}
+
+}  // namespace Fake
+
+inline tcp_pcb * tcp_new() {
+    Fake::pcbs.push_back(new tcp_pcb());
+    return Fake::pcbs.back();
+}
+
+inline void tcp_arg(tcp_pcb * pcb, void * arg) { pcb->arg = arg; }
+inline void tcp_recv(tcp_pcb * pcb, tcp_recv_fn recv) { pcb->recv = recv; }
+inline void tcp_err(tcp_pcb * pcb, tcp_err_fn err) { pcb->err = err; }
+inline void tcp_nagle_disable(tcp_pcb *) {}
+inline void tcp_nagle_enable(tcp_pcb *) {}
+
+inline err_t tcp_connect(tcp_pcb * pcb, const ip_addr_t * address,
+                         uint16_t port, tcp_connected_fn connected) {
+    pcb->connection = std::make_shared<Fake::Connection>();
+    pcb->connection->address = IPAddress(address);
+    pcb->connection->port = port;
+    pcb->connected = connected;
+    return ERR_OK;
+}
+
+inline uint16_t tcp_sndbuf(tcp_pcb *) { return 2 * 1460; }
+
+inline err_t tcp_write(tcp_pcb * pcb, const void * data, uint16_t size,
+                       uint8_t) {
+    if (!pcb->established) {
+        return ERR_CONN;
+    }
+    pcb->connection->sent.append((const char *)data, size);
+    return ERR_OK;
+}
+
+inline err_t tcp_output(tcp_pcb *) { return ERR_OK; }
+inline void tcp_recved(tcp_pcb *, uint16_t) {}
+
+inline err_t tcp_close(tcp_pcb * pcb) {
+    if (pcb->connection) {
+        pcb->connection->stopped = true;
+    }
+    Fake::release(pcb);
+    return ERR_OK;
+}
+
+inline void tcp_abort(tcp_pcb * pcb) {
+    if (pcb->connection) {
+        pcb->connection->aborted = true;
+    }
+    const tcp_err_fn err = pcb->err;
+    void * arg = pcb->arg;
+    Fake::release(pcb);
+    if (err) {
+        err(arg, ERR_ABRT);
+    }
+}
+
+inline void pbuf_ref(pbuf * p) { ++p->ref; }
+
+inline uint8_t pbuf_free(pbuf * p) {
+    uint8_t freed = 0;
+    while (p && (--p->ref == 0)) {
+        pbuf * next = p->next;
+        delete[] (char *)p->payload;
+        delete p;
+        p = next;
+        ++freed;
+    }
+    return freed;
+}
+
+// The chain takes over the reference of tail
+inline void pbuf_cat(pbuf * head, pbuf * tail) {
+    pbuf * p = head;
+    for (; p->next; p = p->next) {
+        p->tot_len += tail->tot_len;
+    }
+    p->tot_len += tail->tot_len;
+    p->next = tail;
+}
+
+inline uint16_t pbuf_copy_partial(const pbuf * p, void * data, uint16_t size,
+                                  uint16_t offset) {
+    uint16_t copied = 0;
+    for (; p && (copied < size); p = p->next) {
+        if (offset >= p->len) {
+            offset -= p->len;
+            continue;
+        }
+        const uint16_t chunk =
+            std::min<uint16_t>(size - copied, p->len - offset);
+        memcpy((char *)data + copied, (const char *)p->payload + offset,
+               chunk);
+        copied += chunk;
+        offset = 0;
+    }
+    return copied;
+}
+
+namespace Fake {
+
+// Completes pending handshakes and delivers queued data and closed connections
+// to the client callbacks
+inline void poll() {
+    // callbacks may release connections, iterate over a copy
+    const std::vector<tcp_pcb *> current = pcbs;
+    for (tcp_pcb * pcb : current) {
+        if ((std::find(pcbs.begin(), pcbs.end(), pcb) == pcbs.end()) ||
+            !pcb->connection) {
+            continue;
+        }
+
+        if (!pcb->established) {
+            if (std::find(unreachable.begin(), unreachable.end(),
+                          pcb->connection->address) != unreachable.end()) {
+                continue;
+            }
+            if (accept && accept(pcb->connection)) {
+                pcb->established = true;
+                if (pcb->connected) {
+                    pcb->connected(pcb->arg, pcb, ERR_OK);
+                }
+            } else {
+                // lwIP frees the pcb before reporting the error
+                const tcp_err_fn err = pcb->err;
+                void * arg = pcb->arg;
+                release(pcb);
+                if (err) {
+                    err(arg, ERR_RST);
+                }
+            }
+            continue;
+        }
+
+        std::string & received = pcb->connection->received;
+        if (!received.empty() && pcb->recv) {
+            pbuf * p = make_pbuf(received);
+            received.clear();
+            pcb->recv(pcb->arg, pcb, p, ERR_OK);
+        } else if (received.empty() && pcb->connection->peer_closed &&
+                   !pcb->fin_delivered && pcb->recv) {
+            pcb->fin_delivered = true;
+            pcb->recv(pcb->arg, pcb, nullptr, ERR_OK);
+        }
+    }
+}
+
+}  // namespace Fake
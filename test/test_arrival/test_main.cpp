@@ -0,0 +1,123 @@
+#include <ArduinoJson.h>
+#include <PicoMQ.h>
+#include <PicoSyslog.h>
+#include <unity.h>
+
+#include "arrival.h"
+#include "mqtt.h"
+#include "schalter.h"
+#include "sensor.h"
+
+PicoSyslog::Logger syslog("calor");
+PicoMQ picomq;
+MQTTServer mqtt;
+
+namespace {
+
+void send_reading(const char * address, const char * value) {
+    mqtt.deliver(String("celsius/test/") + address + "/temperature", value);
+}
+
+// Advances time in ticks of 100 ms
+void run(unsigned long ms) {
+    for (unsigned long t = 0; t < ms; t += 100) {
+        Fake::advance(100);
+        tick_sensors();
+    }
+}
+
+}  // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_timeout_follows_interval() {
+    ArrivalEstimator estimator;
+
+    // the upper bound applies until a few intervals were seen
+    estimator.sample(10 * 1000);
+    estimator.sample(10 * 1000);
+    TEST_ASSERT_EQUAL(5 * 60 * 1000, estimator.timeout(5 * 60 * 1000));
+
+    estimator.sample(10 * 1000);
+    const unsigned long timeout = estimator.timeout(5 * 60 * 1000);
+    TEST_ASSERT_TRUE(timeout >= 30 * 1000);
+    TEST_ASSERT_TRUE(timeout < 60 * 1000);
+
+    // fast devices are never declared stale within the minimum timeout
+    for (int i = 0; i < 50; ++i) {
+        estimator.sample(500);
+    }
+    TEST_ASSERT_EQUAL(ArrivalEstimator::min_timeout,
+                      estimator.timeout(5 * 60 * 1000));
+}
+
+// A chain fails over to its backup within seconds once a sensor reporting
+// every second goes silent, not after the fixed 5 minute timeout
+void test_fast_sensor_fails_over() {
+    JsonDocument config;
+    deserializeJson(config, R"(["fast", "backup"])");
+    const SensorChain chain = get_sensor(config);
+
+    for (int second = 0; second < 60; ++second) {
+        send_reading("fast", "20");
+        if (second % 20 == 0) {
+            send_reading("backup", "18");
+        }
+        run(1000);
+    }
+    TEST_ASSERT_EQUAL(2000, chain.get_reading().centi());
+
+    unsigned long failover_ms = 0;
+    while (chain.get_reading().centi() == 2000) {
+        run(100);
+        failover_ms += 100;
+        TEST_ASSERT_TRUE(failover_ms < Sensor::timeout);
+    }
+    TEST_ASSERT_EQUAL(1800, chain.get_reading().centi());
+    TEST_ASSERT_TRUE(failover_ms <= ArrivalEstimator::min_timeout + 1000);
+}
+
+// Three updates a second apart complete the estimate of a device, so it's
+// considered stale after a few seconds.  The interval from a state restored
+// after a reset isn't sampled, so the estimate isn't complete yet then.
+void test_restore_not_sampled() {
+    Sensor updated_sensor("updated");
+    Sensor restored_sensor("restored");
+    Schalter updated_schalter("updated");
+    Schalter restored_schalter("restored");
+
+    updated_sensor.update(Temperature::from_double(20));
+    restored_sensor.restore(Temperature::from_double(20), 500);
+    updated_schalter.update(Schalter::State::active);
+    restored_schalter.restore(Schalter::State::active);
+
+    for (int i = 0; i < 3; ++i) {
+        Fake::advance(1000);
+        updated_sensor.update(Temperature::from_double(20));
+        restored_sensor.update(Temperature::from_double(20));
+        updated_schalter.update(Schalter::State::active);
+        restored_schalter.update(Schalter::State::active);
+    }
+
+    Fake::advance(10 * 1000);
+    updated_sensor.tick();
+    restored_sensor.tick();
+    updated_schalter.tick();
+    restored_schalter.tick();
+
+    TEST_ASSERT_TRUE(updated_sensor.get_state() == Sensor::State::error);
+    TEST_ASSERT_TRUE(restored_sensor.get_state() == Sensor::State::ok);
+    TEST_ASSERT_TRUE(updated_schalter.get_state() == Schalter::State::error);
+    TEST_ASSERT_TRUE(restored_schalter.get_state() ==
+                     Schalter::State::active);
+}
+
+int main(int argc, char ** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_timeout_follows_interval);
+    RUN_TEST(test_fast_sensor_fails_over);
+    RUN_TEST(test_restore_not_sampled);
+    return UNITY_END();
+}
@@ -0,0 +1,189 @@
+#include <ArduinoJson.h>
+#include <PicoMQ.h>
+#include <PicoSyslog.h>
+#include <lwip/tcp.h>
+#include <unity.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "celsius.h"
+#include "mqtt.h"
+#include "sensor.h"
+
+PicoSyslog::Logger syslog("calor");
+PicoMQ picomq;
+MQTTServer mqtt;
+
+namespace {
+
+// Stand-in for a Celsius device, answers GET /readings with a fixed body
+struct CelsiusStandIn {
+    std::string body = R"({"28aa": 21.5, "28bb": 19.25})";
+    bool keep_alive = true;
+    bool respond = true;
+
+    std::vector<std::shared_ptr<Fake::Connection>> connections;
+    size_t refused = 0;
+    size_t requests = 0;
+
+    void serve() {
+        for (auto & connection : connections) {
+            const size_t end = connection->sent.find("\r\n\r\n");
+            if (connection->peer_closed || (end == std::string::npos)) {
+                continue;
+            }
+            TEST_ASSERT_EQUAL(0, connection->sent.find("GET /readings "));
+            connection->sent.erase(0, end + 4);
+            ++requests;
+
+            if (!respond) {
+                continue;
+            }
+            connection->received +=
+                "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                "Content-Length: " +
+                std::to_string(body.size()) + "\r\n" +
+                (keep_alive ? "" : "Connection: close\r\n") + "\r\n" + body;
+            connection->peer_closed = !keep_alive;
+        }
+    }
+};
+
+CelsiusStandIn * device;
+
+// Runs the poller against the stand-in for the given time
+void run(CelsiusPoller & poller, unsigned long ms) {
+    for (unsigned long t = 0; t < ms; t += 10) {
+        poller.tick();
+        Fake::poll();
+        device->serve();
+        Fake::advance(10);
+    }
+}
+
+Sensor & sensor(const char * address) {
+    for (auto & sensor : get_sensors()) {
+        if (sensor.address == address) {
+            return sensor;
+        }
+    }
+    TEST_ASSERT_TRUE_MESSAGE(false, "sensor not configured");
+    return get_sensors().front();
+}
+
+}  // namespace
+
+void setUp() {
+    device = new CelsiusStandIn();
+    Fake::accept = [](std::shared_ptr<Fake::Connection> connection) {
+        if (connection->port != 80) {
+            ++device->refused;
+            return false;
+        }
+        device->connections.push_back(connection);
+        return true;
+    };
+}
+
+void tearDown() {
+    Fake::accept = nullptr;
+    Fake::unreachable.clear();
+    delete device;
+}
+
+void test_readings_update_sensors() {
+    CelsiusPoller poller("10.0.0.2");
+    run(poller, 100);
+
+    TEST_ASSERT_EQUAL(1, device->requests);
+    TEST_ASSERT_EQUAL(2150, sensor("28aa").get_reading().centi());
+    TEST_ASSERT_EQUAL(1925, sensor("28bb").get_reading().centi());
+}
+
+void test_connection_kept_alive() {
+    CelsiusPoller poller("10.0.0.2");
+    run(poller, 30 * 1000);
+
+    TEST_ASSERT_GREATER_THAN(1, device->requests);
+    TEST_ASSERT_EQUAL(1, device->connections.size());
+    TEST_ASSERT_FALSE(device->connections[0]->stopped);
+    TEST_ASSERT_FALSE(device->connections[0]->aborted);
+}
+
+void test_connection_close_is_graceful() {
+    device->keep_alive = false;
+    CelsiusPoller poller("10.0.0.2");
+    run(poller, 100);
+
+    TEST_ASSERT_EQUAL(1, device->requests);
+    TEST_ASSERT_TRUE(device->connections[0]->stopped);
+    TEST_ASSERT_FALSE(device->connections[0]->aborted);
+
+    // the next poll opens a new connection
+    run(poller, 10 * 1000);
+    TEST_ASSERT_EQUAL(2, device->connections.size());
+}
+
+void test_unreachable_host_times_out() {
+    Fake::unreachable.push_back(IPAddress(10, 0, 0, 3));
+    CelsiusPoller poller("10.0.0.3");
+
+    // ticks don't wait for the handshake, the attempt stays pending
+    poller.tick();
+    TEST_ASSERT_EQUAL(1, Fake::pcbs.size());
+    run(poller, poller.connect_timeout_ms - 100);
+    TEST_ASSERT_EQUAL(1, Fake::pcbs.size());
+
+    run(poller, 200);
+    TEST_ASSERT_EQUAL(0, Fake::pcbs.size());
+    TEST_ASSERT_EQUAL(0, device->connections.size());
+}
+
+void test_timeout_aborts() {
+    device->respond = false;
+    CelsiusPoller poller("10.0.0.2");
+
+    run(poller, poller.response_timeout_ms - 100);
+    TEST_ASSERT_FALSE(device->connections[0]->aborted);
+
+    run(poller, 200);
+    TEST_ASSERT_TRUE(device->connections[0]->aborted);
+    TEST_ASSERT_FALSE(device->connections[0]->stopped);
+}
+
+void test_invalid_response_aborts() {
+    device->body = "{";
+    CelsiusPoller poller("10.0.0.2");
+    run(poller, 100);
+
+    TEST_ASSERT_EQUAL(1, device->requests);
+    TEST_ASSERT_TRUE(device->connections[0]->aborted);
+}
+
+void test_refused_connection_backs_off() {
+    CelsiusPoller poller("10.0.0.2", 8080);
+    run(poller, 30 * 1000);
+
+    // retries after 10 s and then 20 s
+    TEST_ASSERT_EQUAL(2, device->refused);
+    TEST_ASSERT_EQUAL(0, device->connections.size());
+}
+
+int main(int argc, char ** argv) {
+    // the poller only feeds configured sensors
+    JsonDocument config;
+    deserializeJson(config, R"(["28aa", "28bb"])");
+    get_sensor(config);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_readings_update_sensors);
+    RUN_TEST(test_connection_kept_alive);
+    RUN_TEST(test_connection_close_is_graceful);
+    RUN_TEST(test_unreachable_host_times_out);
+    RUN_TEST(test_timeout_aborts);
+    RUN_TEST(test_invalid_response_aborts);
+    RUN_TEST(test_refused_connection_backs_off);
+    return UNITY_END();
+}
@@ -0,0 +1,327 @@
+// Runs every Calor node of a cluster in a process of its own.  The test process
+// plays the MQTT broker: nodes tick in lockstep and the summaries they publish
+// are routed to all nodes before the next step.
+
+#include <ArduinoJson.h>
+#include <PicoMQ.h>
+#include <PicoSyslog.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unity.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "cluster.h"
+#include "hass.h"
+#include "mqtt.h"
+#include "zone.h"
+
+PicoSyslog::Logger syslog("calor");
+PicoMQ picomq;
+MQTTServer mqtt;
+
+std::vector<Zone> zones;
+String hostname;
+
+namespace HomeAssistant {
+PicoMQTT::Client mqtt;
+String broker;
+bool connected() { return mqtt.connected(); }
+}  // namespace HomeAssistant
+
+namespace {
+
+const unsigned long step_ms = 100;
+
+// Node side: executes commands from the broker, one per line
+//   tick <demand> <link>   advance time, tick, report published messages
+//                          and the resulting state, link is 0 while the node
+//                          is disconnected from the broker
+//   msg <topic> <payload>  deliver a message
+void run_node(FILE * in, FILE * out, const char * name, int priority) {
+    hostname = name;
+
+    JsonDocument config;
+    config["name"] = "site";
+    config["priority"] = priority;
+    Cluster::init(config);
+    HomeAssistant::mqtt.is_connected = true;
+
+    char line[512];
+    while (fgets(line, sizeof(line), in)) {
+        line[strcspn(line, "\n")] = 0;
+        if (strncmp(line, "tick ", 5) == 0) {
+            Fake::advance(step_ms);
+            HomeAssistant::mqtt.is_connected = line[7] == '1';
+            const bool relay = Cluster::boiler_demand(line[5] == '1');
+            Cluster::tick();
+
+            for (const auto & message : HomeAssistant::mqtt.published) {
+                fprintf(out, "pub\t%s\t%s\n", message.first.c_str(),
+                        message.second.c_str());
+            }
+            HomeAssistant::mqtt.published.clear();
+
+            const String coordinator =
+                Cluster::get_status()["coordinator"].as<String>();
+            fprintf(out, "state\t%d\t%s\n", relay, coordinator.c_str());
+            fflush(out);
+        } else if (strncmp(line, "msg\t", 4) == 0) {
+            char * topic = line + 4;
+            char * payload = strchr(topic, '\t');
+            *payload++ = 0;
+            HomeAssistant::mqtt.deliver(topic, payload);
+        }
+    }
+}
+
+struct Node {
+    std::string name;
+    pid_t pid;
+    FILE * in;
+    FILE * out;
+
+    bool demand = false;
+    bool connected = true;
+    bool relay = false;
+    std::string coordinator;
+};
+
+class Broker {
+public:
+    ~Broker() {
+        while (!nodes.empty()) {
+            stop(nodes.front().name);
+        }
+    }
+
+    void start(const std::string & name, int priority) {
+        int fds[2];
+        TEST_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+        fflush(stdout);
+        const pid_t pid = fork();
+        TEST_ASSERT_TRUE(pid >= 0);
+
+        if (pid == 0) {
+            // other nodes must see their connection closed when stopped
+            for (const auto & node : nodes) {
+                close(fileno(node.in));
+                close(fileno(node.out));
+            }
+            close(fds[0]);
+            run_node(fdopen(fds[1], "r"), fdopen(dup(fds[1]), "w"),
+                     name.c_str(), priority);
+            _exit(0);
+        }
+
+        close(fds[1]);
+        Node node;
+        node.name = name;
+        node.pid = pid;
+        node.in = fdopen(fds[0], "r");
+        node.out = fdopen(dup(fds[0]), "w");
+        nodes.push_back(node);
+    }
+
+    // Kills the node, it stops publishing without saying goodbye
+    void stop(const std::string & name) {
+        for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+            if (it->name == name) {
+                fclose(it->out);
+                fclose(it->in);
+                waitpid(it->pid, nullptr, 0);
+                nodes.erase(it);
+                return;
+            }
+        }
+    }
+
+    Node & node(const std::string & name) {
+        for (auto & node : nodes) {
+            if (node.name == name) {
+                return node;
+            }
+        }
+        TEST_ASSERT_TRUE_MESSAGE(false, "no such node");
+        return nodes.front();
+    }
+
+    void step() {
+        std::vector<std::string> messages;
+
+        for (auto & node : nodes) {
+            fprintf(node.out, "tick %d %d\n", node.demand, node.connected);
+            fflush(node.out);
+
+            char line[512];
+            while (fgets(line, sizeof(line), node.in)) {
+                line[strcspn(line, "\n")] = 0;
+                if (strncmp(line, "pub\t", 4) == 0) {
+                    if (node.connected) {
+                        messages.push_back(line + 4);
+                    }
+                } else if (strncmp(line, "state\t", 6) == 0) {
+                    node.relay = line[6] == '1';
+                    node.coordinator = line + 8;
+                    break;
+                }
+            }
+        }
+
+        // every node subscribes to all summaries, including its own
+        for (const auto & message : messages) {
+            for (auto & node : nodes) {
+                if (!node.connected) {
+                    continue;
+                }
+                fprintf(node.out, "msg\t%s\n", message.c_str());
+                fflush(node.out);
+            }
+        }
+
+        size_t relays = 0;
+        size_t coordinators = 0;
+        for (const auto & node : nodes) {
+            relays += node.relay;
+            // a node cut off from the broker may coordinate its own zones
+            coordinators += node.connected && (node.coordinator == node.name);
+        }
+        TEST_ASSERT_LESS_OR_EQUAL(1, relays);
+        TEST_ASSERT_LESS_OR_EQUAL(1, coordinators);
+    }
+
+    void run(unsigned long ms) {
+        for (unsigned long t = 0; t < ms; t += step_ms) {
+            step();
+        }
+    }
+
+    // True if all nodes agree on the given coordinator
+    bool agree(const std::string & coordinator) {
+        for (const auto & node : nodes) {
+            if (node.coordinator != coordinator) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<Node> nodes;
+};
+
+}  // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_demand_aggregated_by_coordinator() {
+    Broker broker;
+    broker.start("a", 0);
+    broker.start("b", 1);
+    broker.start("c", 2);
+
+    // nobody claims the role while listening to the others
+    broker.run(4 * 1000);
+    TEST_ASSERT_TRUE(broker.agree(""));
+
+    broker.run(4 * 1000);
+    TEST_ASSERT_TRUE(broker.agree("a"));
+
+    // demand of any node turns on the coordinator's relay only
+    broker.node("c").demand = true;
+    broker.run(1000);
+    TEST_ASSERT_TRUE(broker.node("a").relay);
+    TEST_ASSERT_FALSE(broker.node("b").relay);
+    TEST_ASSERT_FALSE(broker.node("c").relay);
+
+    broker.node("c").demand = false;
+    broker.run(1000);
+    TEST_ASSERT_FALSE(broker.node("a").relay);
+}
+
+void test_failover() {
+    Broker broker;
+    broker.start("a", 0);
+    broker.start("b", 1);
+    broker.start("c", 2);
+    broker.node("c").demand = true;
+    broker.run(10 * 1000);
+    TEST_ASSERT_TRUE(broker.agree("a"));
+
+    broker.stop("a");
+
+    // the coordinator is considered gone after 20 s without a summary
+    broker.run(15 * 1000);
+    TEST_ASSERT_TRUE(broker.agree("a"));
+    TEST_ASSERT_FALSE(broker.node("b").relay);
+
+    broker.run(10 * 1000);
+    TEST_ASSERT_TRUE(broker.agree("b"));
+    TEST_ASSERT_TRUE(broker.node("b").relay);
+    TEST_ASSERT_FALSE(broker.node("c").relay);
+}
+
+void test_rejoin_hands_over_without_overlap() {
+    Broker broker;
+    broker.start("b", 1);
+    broker.start("c", 2);
+    broker.node("c").demand = true;
+    broker.run(10 * 1000);
+    TEST_ASSERT_TRUE(broker.agree("b"));
+
+    // a restarted node with a better priority doesn't take over right away,
+    // step() checks there's never more than one coordinator
+    broker.start("a", 0);
+    broker.run(4 * 1000);
+    TEST_ASSERT_TRUE(broker.node("b").relay);
+    TEST_ASSERT_EQUAL_STRING("b", broker.node("a").coordinator.c_str());
+
+    broker.run(4 * 1000);
+    TEST_ASSERT_TRUE(broker.agree("a"));
+    TEST_ASSERT_TRUE(broker.node("a").relay);
+    TEST_ASSERT_FALSE(broker.node("b").relay);
+}
+
+// A node which loses the broker doesn't claim the role while the coordinator
+// is probably still running
+void test_disconnected_node_waits_for_coordinator() {
+    Broker broker;
+    broker.start("a", 0);
+    broker.start("b", 1);
+    broker.node("b").demand = true;
+    broker.run(10 * 1000);
+    TEST_ASSERT_TRUE(broker.agree("a"));
+    TEST_ASSERT_TRUE(broker.node("a").relay);
+
+    broker.node("b").connected = false;
+    broker.run(15 * 1000);
+    TEST_ASSERT_EQUAL_STRING("", broker.node("b").coordinator.c_str());
+    TEST_ASSERT_FALSE(broker.node("b").relay);
+
+    // once the coordinator would be considered gone, b heats on its own
+    broker.run(10 * 1000);
+    TEST_ASSERT_EQUAL_STRING("b", broker.node("b").coordinator.c_str());
+    TEST_ASSERT_TRUE(broker.node("b").relay);
+    TEST_ASSERT_FALSE(broker.node("a").relay);
+
+    // after reconnecting, b hands back without overlap
+    broker.node("b").connected = true;
+    broker.run(10 * 1000);
+    TEST_ASSERT_TRUE(broker.agree("a"));
+    TEST_ASSERT_TRUE(broker.node("a").relay);
+    TEST_ASSERT_FALSE(broker.node("b").relay);
+}
+
+int main(int argc, char ** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_demand_aggregated_by_coordinator);
+    RUN_TEST(test_failover);
+    RUN_TEST(test_rejoin_hands_over_without_overlap);
+    RUN_TEST(test_disconnected_node_waits_for_coordinator);
+    return UNITY_END();
+}
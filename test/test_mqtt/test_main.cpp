@@ -0,0 +1,75 @@
+#include <ArduinoJson.h>
+#include <PicoMQ.h>
+#include <PicoSyslog.h>
+#include <unity.h>
+
+#include "mqtt.h"
+
+PicoSyslog::Logger syslog("calor");
+PicoMQ picomq;
+MQTTServer mqtt;
+
+namespace {
+
+// Broker with its client hooks exposed.  Clients are simulated by local
+// subscriptions, which take the given time to receive a message.
+class TestServer : public MQTTServer {
+public:
+    void add_client(const char * id, const char * filter,
+                    unsigned long delivery_us) {
+        on_connected(id);
+        on_subscribe(id, filter);
+        subscribe(filter, [delivery_us](const String &) {
+            Fake::advance_us(delivery_us);
+        });
+    }
+};
+
+}  // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+// The time of a message delivered to several clients isn't credited to each
+// of them
+void test_shared_messages_not_attributed() {
+    TestServer server;
+    server.add_client("slow", "valve/#", 300 * 1000);
+    server.add_client("fast", "#", 1000);
+
+    for (int i = 0; i < 50; ++i) {
+        server.deliver("valve/x", "1");
+        server.deliver("sensor/x", "1");
+    }
+
+    const JsonDocument status = server.get_status();
+    TEST_ASSERT_EQUAL(100, status["clients"]["fast"]["delivered"] | 0);
+    TEST_ASSERT_INT_WITHIN(100, 1000,
+                           status["clients"]["fast"]["delivery_us"] | 0);
+    TEST_ASSERT_TRUE(status["clients"]["slow"]["delivery_us"].isNull());
+}
+
+void test_slowest_client() {
+    TestServer server;
+    server.add_client("slow", "valve/#", 300 * 1000);
+    server.add_client("fast", "sensor/#", 1000);
+
+    for (int i = 0; i < 50; ++i) {
+        server.deliver("valve/x", "1");
+        server.deliver("sensor/x", "1");
+    }
+
+    const JsonDocument status = server.get_status();
+    TEST_ASSERT_EQUAL_STRING("slow", status["slowest_client"] | "");
+    TEST_ASSERT_INT_WITHIN(20 * 1000, 300 * 1000,
+                           status["clients"]["slow"]["delivery_us"] | 0);
+    TEST_ASSERT_FALSE(server.healthcheck());
+}
+
+int main(int argc, char ** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_shared_messages_not_attributed);
+    RUN_TEST(test_slowest_client);
+    return UNITY_END();
+}
@@ -0,0 +1,95 @@
+#include <ArduinoJson.h>
+#include <PicoMQ.h>
+#include <PicoSyslog.h>
+#include <unity.h>
+
+#include <cstdlib>
+#include <ctime>
+
+#include "mqtt.h"
+#include "schedule.h"
+
+PicoSyslog::Logger syslog("calor");
+PicoMQ picomq;
+MQTTServer mqtt;
+
+namespace {
+
+// Monday, 2024-01-01 00:00 UTC
+const time_t monday = 1704067200;
+
+time_t at(int day, int hour, int minute) {
+    return monday + ((day * 24 + hour) * 60 + minute) * 60;
+}
+
+Schedule make_schedule(const char * config) {
+    JsonDocument json;
+    deserializeJson(json, config);
+    return Schedule(json);
+}
+
+}  // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_first_evaluation_does_not_fire() {
+    Schedule schedule =
+        make_schedule(R"({"mon-fri": {"06:30": 21, "22:00": 18}})");
+
+    TEST_ASSERT_FALSE(schedule.update(at(0, 12, 0)));
+    TEST_ASSERT_EQUAL(2100, schedule.get_desired().centi());
+    TEST_ASSERT_EQUAL(at(0, 22, 0), schedule.get_deadline());
+    TEST_ASSERT_FALSE(schedule.update(at(0, 21, 59)));
+}
+
+void test_fires_when_crossing_a_transition() {
+    Schedule schedule =
+        make_schedule(R"({"mon-fri": {"06:30": 21, "22:00": 18}})");
+    schedule.update(at(0, 12, 0));
+
+    TEST_ASSERT_TRUE(schedule.update(at(0, 22, 0)));
+    TEST_ASSERT_EQUAL(1800, schedule.get_desired().centi());
+    TEST_ASSERT_FALSE(schedule.update(at(0, 23, 0)));
+
+    // the weekend has no transitions, Friday's last one lasts until Monday
+    schedule.update(at(4, 21, 0));
+    TEST_ASSERT_TRUE(schedule.update(at(4, 22, 0)));
+    TEST_ASSERT_EQUAL(at(7, 6, 30), schedule.get_deadline());
+}
+
+void test_clock_going_back_does_not_fire() {
+    Schedule schedule =
+        make_schedule(R"({"mon-fri": {"06:30": 21, "22:00": 18}})");
+    schedule.update(at(0, 23, 0));
+
+    TEST_ASSERT_FALSE(schedule.update(at(0, 12, 0)));
+    TEST_ASSERT_EQUAL(2100, schedule.get_desired().centi());
+}
+
+void test_equivalent_configs_compare_equal() {
+    const Schedule a =
+        make_schedule(R"({"mon-fri": {"06:30": 21, "22:00": 18}})");
+    const Schedule b = make_schedule(
+        R"({"mon,tue,wed": {"22:00": 18, "06:30": 21},
+            "thu-fri": {"06:30": 21, "22:00": 18}})");
+    const Schedule c =
+        make_schedule(R"({"mon-fri": {"06:30": 21, "22:00": 18.5}})");
+
+    TEST_ASSERT_TRUE(a == b);
+    TEST_ASSERT_TRUE(a != c);
+    TEST_ASSERT_TRUE(Schedule() == make_schedule("{}"));
+}
+
+int main(int argc, char ** argv) {
+    setenv("TZ", "UTC0", 1);
+    tzset();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_first_evaluation_does_not_fire);
+    RUN_TEST(test_fires_when_crossing_a_transition);
+    RUN_TEST(test_clock_going_back_does_not_fire);
+    RUN_TEST(test_equivalent_configs_compare_equal);
+    return UNITY_END();
+}
@@ -0,0 +1,128 @@
+#include <ArduinoJson.h>
+#include <PicoMQ.h>
+#include <PicoSyslog.h>
+#include <PicoUtils.h>
+#include <unity.h>
+
+#include <vector>
+
+#include "mqtt.h"
+#include "snapshot.h"
+#include "zone.h"
+
+PicoSyslog::Logger syslog("calor");
+PicoMQ picomq;
+MQTTServer mqtt;
+
+std::vector<Zone> zones;
+PicoUtils::PinOutput heating_relay(0, true);
+
+namespace {
+
+const char * config = R"({
+    "a": {"sensor": "t1", "valve": {"name": "v1", "switch_time": 5},
+          "desired": 20.0625},
+    "b": {"sensor": ["t2", "t1"], "valve": "v2", "enabled": false}
+})";
+
+void load(const char * config) {
+    JsonDocument json;
+    deserializeJson(json, config);
+    load_zones(zones, json.as<JsonObjectConst>());
+}
+
+// Drops all state, like a reset does, and loads the given config
+void reboot(const char * new_config) {
+    load("{}");
+    heating_relay.set(false);
+    load(new_config);
+}
+
+// Brings the zones into a state worth saving
+void run() {
+    mqtt.deliver("celsius/test/t1/temperature", "19.5");
+    mqtt.deliver("celsius/test/t2/temperature", "21");
+    mqtt.deliver("schalter/v1", "TON");
+    mqtt.deliver("schalter/v2", "OFF");
+    tick_topology(zones);
+    zones[1].boost(600);
+    heating_relay.set(true);
+    Fake::advance(3000);
+}
+
+}  // namespace
+
+void setUp() { reboot(config); }
+
+void tearDown() {}
+
+void test_round_trip() {
+    run();
+    TEST_ASSERT_TRUE(zones[0].get_state() == Zone::State::heat);
+    TEST_ASSERT_TRUE(zones[1].get_state() == Zone::State::wait);
+    Snapshot::save();
+
+    reboot(config);
+    Fake::advance(2000);
+    TEST_ASSERT_TRUE(zones[0].get_state() == Zone::State::init);
+    TEST_ASSERT_TRUE(Snapshot::restore());
+
+    TEST_ASSERT_TRUE(zones[0].get_state() == Zone::State::heat);
+    TEST_ASSERT_TRUE(zones[1].get_state() == Zone::State::wait);
+    TEST_ASSERT_TRUE(zones[0].enabled);
+    TEST_ASSERT_FALSE(zones[1].enabled);
+    TEST_ASSERT_EQUAL(597, zones[1].boost_remaining());
+    TEST_ASSERT_TRUE(heating_relay.get());
+
+    // desired values keep their full precision
+    TEST_ASSERT_EQUAL(Temperature::parse("20.0625").units(),
+                      zones[0].desired.units());
+    TEST_ASSERT_EQUAL(Temperature::parse("21").units(),
+                      zones[1].desired.units());
+
+    // readings keep their age, taken before the snapshot was saved
+    const Sensor & t1 = get_sensors()[0];
+    TEST_ASSERT_TRUE(t1.address == "t1");
+    TEST_ASSERT_TRUE(t1.get_state() == Sensor::State::ok);
+    TEST_ASSERT_EQUAL(1950, t1.get_reading().centi());
+    TEST_ASSERT_EQUAL(3000, t1.get_age());
+    TEST_ASSERT_EQUAL(2100, zones[1].get_reading().centi());
+
+    TEST_ASSERT_TRUE(zones[0].get_valve().get_state() ==
+                     Schalter::State::activating);
+    TEST_ASSERT_TRUE(zones[1].get_valve().get_state() ==
+                     Schalter::State::inactive);
+}
+
+void test_restored_once() {
+    run();
+    Snapshot::save();
+
+    reboot(config);
+    TEST_ASSERT_TRUE(Snapshot::restore());
+
+    reboot(config);
+    TEST_ASSERT_FALSE(Snapshot::restore());
+    TEST_ASSERT_TRUE(zones[0].get_state() == Zone::State::init);
+}
+
+void test_other_config_ignored() {
+    run();
+    Snapshot::save();
+
+    reboot(R"({
+        "a": {"sensor": "t1", "valve": {"name": "v1", "switch_time": 5}},
+        "b": {"sensor": "t3", "valve": "v2"}
+    })");
+    TEST_ASSERT_FALSE(Snapshot::restore());
+    TEST_ASSERT_TRUE(zones[0].get_state() == Zone::State::init);
+    TEST_ASSERT_FALSE(heating_relay.get());
+}
+
+int main(int argc, char ** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_restored_once);
+    RUN_TEST(test_other_config_ignored);
+    return UNITY_END();
+}
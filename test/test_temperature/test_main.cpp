@@ -0,0 +1,94 @@
+#include <PicoMQ.h>
+#include <PicoSyslog.h>
+#include <unity.h>
+
+#include "mqtt.h"
+#include "temperature.h"
+
+PicoSyslog::Logger syslog("calor");
+PicoMQ picomq;
+MQTTServer mqtt;
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_parse() {
+    TEST_ASSERT_EQUAL(21 * 400, Temperature::parse("21").units());
+    TEST_ASSERT_EQUAL(8425, Temperature::parse("21.0625").units());
+    TEST_ASSERT_EQUAL(-8425, Temperature::parse("-21.0625").units());
+    TEST_ASSERT_EQUAL(200, Temperature::parse(".5").units());
+    TEST_ASSERT_EQUAL(4, Temperature::parse("0.01").units());
+    // beyond four decimals, the value is rounded
+    TEST_ASSERT_EQUAL(8425, Temperature::parse("21.06249").units());
+    TEST_ASSERT_EQUAL(8413, Temperature::parse("21.03125").units());
+
+    TEST_ASSERT_FALSE(Temperature::parse("").is_valid());
+    TEST_ASSERT_FALSE(Temperature::parse("nan").is_valid());
+    TEST_ASSERT_FALSE(Temperature::parse("-").is_valid());
+    TEST_ASSERT_FALSE(Temperature::parse("1000").is_valid());
+}
+
+void test_sixteenths_are_exact() {
+    for (int sixteenths = -16 * 60; sixteenths <= 16 * 120; ++sixteenths) {
+        const double degrees = sixteenths / 16.0;
+        char text[16];
+        snprintf(text, sizeof(text), "%.4f", degrees);
+
+        const Temperature parsed = Temperature::parse(text);
+        TEST_ASSERT_EQUAL(sixteenths * 25, parsed.units());
+        TEST_ASSERT_TRUE(parsed == Temperature::from_double(degrees));
+        TEST_ASSERT_TRUE(parsed.to_double() == degrees);
+    }
+}
+
+void test_hundredths_are_exact() {
+    for (int centi = -6000; centi <= 12000; ++centi) {
+        char text[16];
+        snprintf(text, sizeof(text), "%.2f", centi / 100.0);
+
+        const Temperature parsed = Temperature::parse(text);
+        TEST_ASSERT_TRUE(parsed == Temperature::from_centi(centi));
+        TEST_ASSERT_TRUE(parsed == Temperature::from_double(centi / 100.0));
+        TEST_ASSERT_EQUAL(centi, parsed.centi());
+    }
+}
+
+namespace {
+
+void assert_str(const char * expected, const char * text) {
+    const String str = Temperature::parse(text).str();
+    TEST_ASSERT_EQUAL_STRING(expected, str.c_str());
+}
+
+}  // namespace
+
+void test_str() {
+    assert_str("21.00", "21");
+    assert_str("21.50", "21.5");
+    assert_str("21.0625", "21.0625");
+    assert_str("-0.25", "-0.25");
+    assert_str("nan", "x");
+}
+
+void test_invalid_compares_false() {
+    const Temperature invalid = Temperature::invalid();
+    const Temperature valid = Temperature::from_centi(2100);
+
+    TEST_ASSERT_FALSE(invalid == invalid);
+    TEST_ASSERT_FALSE(invalid < valid);
+    TEST_ASSERT_FALSE(invalid > valid);
+    TEST_ASSERT_FALSE(invalid <= valid);
+    TEST_ASSERT_FALSE(valid >= invalid);
+    TEST_ASSERT_FALSE(Temperature::from_centi(INT16_MIN).is_valid());
+}
+
+int main(int argc, char ** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_parse);
+    RUN_TEST(test_sixteenths_are_exact);
+    RUN_TEST(test_hundredths_are_exact);
+    RUN_TEST(test_str);
+    RUN_TEST(test_invalid_compares_false);
+    return UNITY_END();
+}
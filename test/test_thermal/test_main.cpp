@@ -0,0 +1,180 @@
+// Zones controlling a simulated room, to check what the thermal model learns
+// against the known behavior of the room.
+
+#include <ArduinoJson.h>
+#include <PicoMQ.h>
+#include <PicoSyslog.h>
+#include <unity.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "mqtt.h"
+#include "zone.h"
+
+PicoSyslog::Logger syslog("calor");
+PicoMQ picomq;
+MQTTServer mqtt;
+
+namespace {
+
+// A room heated by a radiator.  The radiator follows the boiler with a lag,
+// which makes the room overshoot after heating stops.  Both lose heat
+// following Newton's law of cooling.
+struct Room {
+    double temperature;
+    double radiator;
+    // time constant in seconds, about 10 minutes for panel radiators, much
+    // longer for underfloor heating
+    double radiator_lag;
+
+    static constexpr double outside = 5;
+    static constexpr double supply = 60;
+    static constexpr double radiator_to_room = 48000;
+    static constexpr double room_to_outside = 36000;
+
+    Room(double temperature, double radiator_lag)
+        : temperature(temperature),
+          radiator(temperature),
+          radiator_lag(radiator_lag) {}
+
+    void step(bool heating, double seconds) {
+        const double radiator_target = heating ? supply : temperature;
+        radiator += (radiator_target - radiator) * seconds / radiator_lag;
+        temperature += ((radiator - temperature) / radiator_to_room -
+                        (temperature - outside) / room_to_outside) *
+                       seconds;
+    }
+
+    // like a DS18B20, in sixteenths of a degree
+    String reading() const {
+        char buffer[16];
+        snprintf(buffer, sizeof(buffer), "%.4f",
+                 std::round(temperature * 16) / 16);
+        return buffer;
+    }
+};
+
+struct Simulation {
+    std::vector<Zone> zones;
+    std::vector<Room> rooms;
+    std::vector<String> sensors;
+    unsigned long seconds = 0;
+
+    void add(const char * sensor, double radiator_lag, bool predictive) {
+        JsonDocument config;
+        config["sensor"] = sensor;
+        config["desired"] = 21;
+        config["hysteresis"] = 0.5;
+        config["predictive"] = predictive;
+        zones.emplace_back(zones.size(), sensor, config);
+        rooms.emplace_back(19, radiator_lag);
+        sensors.push_back(sensor);
+    }
+
+    // Runs for the given time, calls check after every second
+    template <typename F>
+    void run(unsigned long duration, F check) {
+        for (unsigned long end = seconds + duration; seconds < end; ++seconds) {
+            if (seconds % 30 == 0) {
+                for (size_t idx = 0; idx < rooms.size(); ++idx) {
+                    mqtt.deliver("celsius/sim/" + sensors[idx] + "/temperature",
+                                 rooms[idx].reading());
+                }
+            }
+            tick_topology(zones);
+            for (size_t idx = 0; idx < rooms.size(); ++idx) {
+                rooms[idx].step(zones[idx].heat(), 1);
+            }
+            Fake::advance(1000);
+            check();
+        }
+    }
+
+    void run(unsigned long duration) {
+        run(duration, [] {});
+    }
+};
+
+const unsigned long hour = 60 * 60;
+
+}  // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+// After learning from regular cycles, the predicted time to heat the room up
+// matches the time it actually takes
+void test_time_to_target() {
+    Simulation sim;
+    sim.add("r1", 600, false);
+    sim.run(12 * hour);
+
+    const JsonDocument status = sim.zones[0].get_status();
+    TEST_ASSERT_TRUE((status["thermal"]["heating_rate"] | 0.0) > 0);
+    TEST_ASSERT_TRUE((status["thermal"]["cooling_rate"] | 0.0) < 0);
+
+    // let the room cool down, then heat it up again
+    sim.zones[0].desired = Temperature::from_double(18);
+    sim.run(6 * hour);
+    sim.zones[0].desired = Temperature::from_double(21);
+    sim.run(1);
+
+    const long predicted = sim.zones[0].get_status()["time_to_target"] | -1l;
+    TEST_ASSERT_GREATER_THAN(0, predicted);
+
+    const unsigned long start = sim.seconds;
+    unsigned long reached = 0;
+    sim.run(6 * hour, [&] {
+        if (!reached && sim.rooms[0].temperature >= 21) {
+            reached = sim.seconds;
+        }
+    });
+    TEST_ASSERT_GREATER_THAN(0, reached);
+
+    const long actual = reached - start;
+    char message[64];
+    snprintf(message, sizeof(message), "predicted %ld s, took %ld s", predicted,
+             actual);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_INT_WITHIN(actual / 4, actual, predicted);
+}
+
+// With a slow emitter, stopping early by the learned overshoot keeps the room
+// closer to the setpoint than plain hysteresis control, without letting it get
+// cold
+void test_predictive_cuts_overshoot() {
+    Simulation sim;
+    sim.add("r2", 2400, false);
+    sim.add("r3", 2400, true);
+    sim.run(12 * hour);
+
+    double peak[2] = {0, 0};
+    double low[2] = {100, 100};
+    sim.run(12 * hour, [&] {
+        for (size_t idx = 0; idx < 2; ++idx) {
+            peak[idx] = std::max(peak[idx], sim.rooms[idx].temperature);
+            low[idx] = std::min(low[idx], sim.rooms[idx].temperature);
+        }
+    });
+
+    char message[128];
+    snprintf(message, sizeof(message),
+             "plain %.2f-%.2f ºC, predictive %.2f-%.2f ºC", low[0], peak[0],
+             low[1], peak[1]);
+    TEST_MESSAGE(message);
+
+    const JsonDocument status = sim.zones[1].get_status();
+    TEST_ASSERT_TRUE((status["thermal"]["overshoot"] | 0.0) > 0);
+    TEST_ASSERT_TRUE(peak[1] < peak[0] - 0.1);
+    TEST_ASSERT_TRUE(low[1] > 21 - 0.25 - 0.2);
+}
+
+int main(int argc, char ** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_time_to_target);
+    RUN_TEST(test_predictive_cuts_overshoot);
+    return UNITY_END();
+}
@@ -0,0 +1,266 @@
+#include <ArduinoJson.h>
+#include <PicoMQ.h>
+#include <PicoSyslog.h>
+#include <unity.h>
+
+#include <vector>
+
+#include "mqtt.h"
+#include "zone.h"
+
+PicoSyslog::Logger syslog("calor");
+PicoMQ picomq;
+MQTTServer mqtt;
+
+namespace {
+
+void send_reading(const char * address, const char * value) {
+    mqtt.deliver(String("celsius/test/") + address + "/temperature", value);
+}
+
+void send_valve_state(const char * name, const char * state) {
+    mqtt.deliver(String("schalter/") + name, state);
+}
+
+void reload(std::vector<Zone> & zones, const char * config) {
+    JsonDocument json;
+    deserializeJson(json, config);
+    load_zones(zones, json.as<JsonObjectConst>());
+}
+
+std::vector<Zone> make_zones(const char * config) {
+    std::vector<Zone> zones;
+    reload(zones, config);
+    return zones;
+}
+
+// Ticks the topology once, checking that every sensor and schalter was ticked
+// exactly once
+void tick_once(std::vector<Zone> & zones) {
+    std::vector<uint32_t> sensor_ticks;
+    for (const auto & sensor : get_sensors()) {
+        sensor_ticks.push_back(sensor.ticks);
+    }
+    std::vector<uint32_t> schalter_ticks;
+    for (const auto & schalter : get_schalters()) {
+        schalter_ticks.push_back(schalter.ticks);
+    }
+
+    tick_topology(zones);
+
+    for (size_t idx = 0; idx < sensor_ticks.size(); ++idx) {
+        TEST_ASSERT_EQUAL(sensor_ticks[idx] + 1, get_sensors()[idx].ticks);
+    }
+    for (size_t idx = 0; idx < schalter_ticks.size(); ++idx) {
+        TEST_ASSERT_EQUAL(schalter_ticks[idx] + 1,
+                          get_schalters()[idx].ticks);
+    }
+}
+
+unsigned long switch_time_ms(const char * name) {
+    for (const auto & schalter : get_schalters()) {
+        if (schalter.name == name) {
+            return schalter.switch_time_ms;
+        }
+    }
+    TEST_ASSERT_TRUE_MESSAGE(false, "no such schalter");
+    return 0;
+}
+
+size_t count_subscriptions(const char * topic) {
+    size_t count = 0;
+    for (const auto & subscription : mqtt.subscriptions) {
+        count += (subscription.first == topic);
+    }
+    return count;
+}
+
+size_t count_published(const char * name) {
+    const String topic = String("schalter/") + name + "/set";
+    size_t count = 0;
+    for (const auto & message : mqtt.published) {
+        count += (message.first == topic);
+    }
+    return count;
+}
+
+}  // namespace
+
+void setUp() { mqtt.published.clear(); }
+
+void tearDown() {}
+
+// A zone sees the aggregated state of its valve list in the same cycle the
+// elements reported it, not one cycle later
+void test_set_state_is_current() {
+    auto zones = make_zones(R"({
+        "list": {"sensor": "t1", "valve": ["l1", "l2"]}
+    })");
+
+    send_reading("t1", "18");
+    send_valve_state("l1", "OFF");
+    send_valve_state("l2", "OFF");
+    tick_topology(zones);
+
+    TEST_ASSERT_TRUE(zones[0].get_valve().get_state() ==
+                     Schalter::State::inactive);
+    TEST_ASSERT_TRUE(zones[0].get_state() == Zone::State::heat);
+
+    send_valve_state("l1", "ON");
+    send_valve_state("l2", "ON");
+    tick_topology(zones);
+
+    TEST_ASSERT_TRUE(zones[0].get_valve().get_state() ==
+                     Schalter::State::active);
+    TEST_ASSERT_TRUE(zones[0].heat());
+}
+
+// Sensors and schalters shared by several zones are ticked once per cycle, so a
+// shared schalter publishes a changed request once, and the periodic refresh
+// once as well
+void test_shared_schalter_ticked_once() {
+    auto zones = make_zones(R"({
+        "a": {"sensor": "t2", "valve": "shared"},
+        "b": {"sensor": ["t3", "t2"], "valve": "shared"},
+        "c": {"sensor": "t2", "valve": ["shared", "own"]}
+    })");
+
+    send_reading("t2", "18");
+    send_reading("t3", "18");
+    send_valve_state("shared", "OFF");
+    send_valve_state("own", "OFF");
+
+    tick_once(zones);
+    TEST_ASSERT_EQUAL(1, count_published("shared"));
+    TEST_ASSERT_EQUAL(1, count_published("own"));
+
+    mqtt.published.clear();
+    tick_once(zones);
+    TEST_ASSERT_EQUAL(0, count_published("shared"));
+
+    Fake::advance(30 * 1000);
+    send_reading("t2", "18");
+    send_reading("t3", "18");
+    send_valve_state("shared", "ON");
+    send_valve_state("own", "ON");
+    tick_once(zones);
+    TEST_ASSERT_EQUAL(1, count_published("shared"));
+    TEST_ASSERT_EQUAL(1, count_published("own"));
+}
+
+// A schalter stays requested as long as any of the zones sharing it wants it
+void test_shared_schalter_requests() {
+    auto zones = make_zones(R"({
+        "x": {"sensor": "t4", "valve": "common"},
+        "y": {"sensor": "t5", "valve": "common"}
+    })");
+
+    send_reading("t4", "18");
+    send_reading("t5", "18");
+    send_valve_state("common", "OFF");
+    tick_topology(zones);
+    TEST_ASSERT_TRUE(mqtt.published.back().second == "ON");
+
+    mqtt.published.clear();
+    send_reading("t4", "25");
+    tick_topology(zones);
+    TEST_ASSERT_EQUAL(0, count_published("common"));
+
+    send_reading("t5", "25");
+    tick_topology(zones);
+    TEST_ASSERT_EQUAL(1, count_published("common"));
+    TEST_ASSERT_TRUE(mqtt.published.back().second == "OFF");
+}
+
+// Reloading the same config again and again doesn't grow the topology, unused
+// sensors and schalters are dropped and the remaining ones still get updates
+void test_reload_drops_unused() {
+    const char * config = R"({
+        "p": {"sensor": ["r1", "r2"],
+              "valve": {"name": "v1", "switch_time": 5}},
+        "q": {"sensor": "r3", "valve": ["v2", "v3"]}
+    })";
+    // the same config, written differently
+    const char * reordered = R"({
+        "p": {"valve": {"switch_time": 5, "name": "v1"},
+              "sensor": ["r1", "r2"]},
+        "q": {"valve": ["v2", "v3"], "sensor": "r3"}
+    })";
+
+    std::vector<Zone> zones;
+    reload(zones, config);
+    const size_t sensors = get_sensors().size();
+    const size_t schalters = get_schalters().size();
+
+    send_valve_state("v2", "ON");
+    send_valve_state("v3", "ON");
+    tick_topology(zones);
+    const auto state = zones[1].get_valve().get_state();
+
+    for (int i = 0; i < 100; ++i) {
+        reload(zones, (i % 2) ? config : reordered);
+    }
+    TEST_ASSERT_EQUAL(sensors, get_sensors().size());
+    TEST_ASSERT_EQUAL(schalters, get_schalters().size());
+    TEST_ASSERT_EQUAL(1, count_subscriptions("celsius/+/r3/temperature"));
+    TEST_ASSERT_TRUE(zones[1].get_valve().get_state() == state);
+
+    // zone p is removed, its valve is turned off
+    mqtt.published.clear();
+    reload(zones, R"({"q": {"sensor": "r3", "valve": ["v2", "v3"]}})");
+    TEST_ASSERT_EQUAL(sensors - 2, get_sensors().size());
+    TEST_ASSERT_EQUAL(schalters - 1, get_schalters().size());
+    TEST_ASSERT_EQUAL(0, count_subscriptions("celsius/+/r1/temperature"));
+    TEST_ASSERT_EQUAL(0, count_subscriptions("schalter/v1"));
+    TEST_ASSERT_EQUAL(1, count_published("v1"));
+    TEST_ASSERT_TRUE(mqtt.published.back().second == "OFF");
+
+    // the moved sensor is updated through its new index
+    send_reading("r3", "19.5");
+    TEST_ASSERT_EQUAL(1950, zones[0].get_reading().centi());
+    TEST_ASSERT_EQUAL(1, count_subscriptions("celsius/+/r3/temperature"));
+}
+
+// A schalter referenced by plain name in one zone keeps the switch time
+// configured in another, regardless of the order of the zones
+void test_shared_switch_time() {
+    std::vector<Zone> zones;
+    reload(zones, R"({
+        "a": {"sensor": "w1", "valve": {"name": "sw", "switch_time": 10}},
+        "b": {"sensor": "w2", "valve": "sw"}
+    })");
+    TEST_ASSERT_EQUAL(10000, switch_time_ms("sw"));
+
+    reload(zones, R"({
+        "b": {"sensor": "w2", "valve": "sw"},
+        "a": {"sensor": "w1", "valve": {"name": "sw", "switch_time": 10}}
+    })");
+    TEST_ASSERT_EQUAL(10000, switch_time_ms("sw"));
+
+    // conflicting values, the longest wins
+    reload(zones, R"({
+        "a": {"sensor": "w1", "valve": {"name": "sw", "switch_time": 10}},
+        "b": {"sensor": "w2", "valve": {"name": "sw", "switch_time": 20}}
+    })");
+    TEST_ASSERT_EQUAL(20000, switch_time_ms("sw"));
+
+    // a shorter switch time applies after reloading
+    reload(zones, R"({
+        "a": {"sensor": "w1", "valve": {"name": "sw", "switch_time": 5}},
+        "b": {"sensor": "w2", "valve": "sw"}
+    })");
+    TEST_ASSERT_EQUAL(5000, switch_time_ms("sw"));
+
+    reload(zones, R"({"b": {"sensor": "w2", "valve": "sw"}})");
+    TEST_ASSERT_EQUAL(0, switch_time_ms("sw"));
+}
+
+int main(int argc, char ** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_set_state_is_current);
+    RUN_TEST(test_shared_schalter_ticked_once);
+    RUN_TEST(test_shared_schalter_requests);
+    RUN_TEST(test_reload_drops_unused);
+    RUN_TEST(test_shared_switch_time);
+    return UNITY_END();
+}
@@ -0,0 +1,176 @@
+// A zone driving a simulated valve controller, to check when the boiler may
+// fire relative to the valve actually opening.
+
+#include <ArduinoJson.h>
+#include <PicoMQ.h>
+#include <PicoSyslog.h>
+#include <unity.h>
+
+#include <vector>
+
+#include "mqtt.h"
+#include "zone.h"
+
+PicoSyslog::Logger syslog("calor");
+PicoMQ picomq;
+MQTTServer mqtt;
+
+namespace {
+
+const unsigned long step_ms = 100;
+
+// Valve controller answering set commands like a Valvola: TON when it starts
+// opening, ON once it's open, both reaching Calor after a delay
+struct ValveController {
+    const char * name;
+    unsigned long open_ms = 10 * 1000;
+    unsigned long latency_ms = 0;
+    bool confirms = true;
+
+    bool commanded = false;
+    unsigned long since = 0;
+
+    struct Message {
+        unsigned long due;
+        const char * payload;
+    };
+    std::vector<Message> outbox;
+
+    // Physically open, opening takes open_ms
+    bool is_open(unsigned long now) const {
+        return commanded && (now - since >= open_ms);
+    }
+
+    void tick(unsigned long now) {
+        for (const auto & message : mqtt.published) {
+            if (message.first != String("schalter/") + name + "/set") {
+                continue;
+            }
+            const bool on = (message.second == "ON");
+            if (on != commanded) {
+                commanded = on;
+                since = now;
+                outbox.push_back({now + latency_ms, on ? "TON" : "TOFF"});
+                if (confirms || !on) {
+                    outbox.push_back(
+                        {now + open_ms + latency_ms, on ? "ON" : "OFF"});
+                }
+            }
+        }
+
+        for (auto it = outbox.begin(); it != outbox.end();) {
+            if (it->due <= now) {
+                mqtt.deliver(String("schalter/") + name, it->payload);
+                it = outbox.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+};
+
+struct Simulation {
+    std::vector<Zone> zones;
+    ValveController valve;
+    unsigned long now = 0;
+
+    // Time the boiler started getting heat demand, 0 if it didn't
+    unsigned long heat_since = 0;
+
+    explicit Simulation(const ValveController & valve) : valve(valve) {
+        JsonDocument config;
+        config["sensor"] = "room";
+        config["valve"]["name"] = valve.name;
+        config["valve"]["switch_time"] = 10;
+        zones.emplace_back(0, "zone", config);
+
+        mqtt.deliver(String("schalter/") + valve.name, "OFF");
+    }
+
+    void run(unsigned long ms, const char * reading) {
+        for (unsigned long end = now + ms; now < end; now += step_ms) {
+            if (now % 10000 == 0) {
+                mqtt.deliver("celsius/test/room/temperature", reading);
+            }
+            mqtt.published.clear();
+            tick_topology(zones);
+            valve.tick(now);
+
+            const bool heat = zones[0].heat();
+            if (heat && !heat_since) {
+                heat_since = now;
+            }
+            // the boiler never runs against a closed valve
+            TEST_ASSERT_TRUE(!heat || valve.is_open(now));
+
+            Fake::advance(step_ms);
+        }
+    }
+};
+
+}  // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+// With a slow confirmation, the boiler fires once the switch time passed, not
+// when the ON message finally arrives
+void test_fires_after_switch_time() {
+    ValveController valve;
+    valve.name = "slow_confirmation";
+    valve.latency_ms = 3 * 1000;
+    Simulation sim(valve);
+
+    sim.run(60 * 1000, "18");
+    TEST_ASSERT_TRUE(sim.zones[0].heat());
+    // TON arrives after 3 s, the valve is assumed open 10 s later, well before
+    // ON arrives after 13 s
+    TEST_ASSERT_INT_WITHIN(500, 13 * 1000, sim.heat_since);
+    TEST_ASSERT_TRUE(sim.zones[0].get_valve().get_state() ==
+                     Schalter::State::active);
+}
+
+// Without a confirmation, the valve is assumed open only up to twice the
+// switch time, then it's in error state and the zone stops heating
+void test_unconfirmed_valve_goes_to_error() {
+    ValveController valve;
+    valve.name = "unconfirmed";
+    valve.confirms = false;
+    Simulation sim(valve);
+
+    sim.run(15 * 1000, "18");
+    TEST_ASSERT_TRUE(sim.zones[0].heat());
+
+    sim.run(10 * 1000, "18");
+    TEST_ASSERT_FALSE(sim.zones[0].heat());
+    TEST_ASSERT_TRUE(sim.zones[0].get_valve().get_state() ==
+                     Schalter::State::error);
+    TEST_ASSERT_TRUE(sim.zones[0].get_state() == Zone::State::error);
+}
+
+// Once warm, the boiler stops right away, while the valve stays open for the
+// switch time, so other valves can take over
+void test_stops_before_valve_closes() {
+    ValveController valve;
+    valve.name = "close_down";
+    Simulation sim(valve);
+
+    sim.run(60 * 1000, "18");
+    TEST_ASSERT_TRUE(sim.zones[0].heat());
+
+    sim.run(5 * 1000, "25");
+    TEST_ASSERT_FALSE(sim.zones[0].heat());
+    TEST_ASSERT_TRUE(sim.valve.commanded);
+
+    sim.run(60 * 1000, "25");
+    TEST_ASSERT_FALSE(sim.valve.commanded);
+}
+
+int main(int argc, char ** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_fires_after_switch_time);
+    RUN_TEST(test_unconfirmed_valve_goes_to_error);
+    RUN_TEST(test_stops_before_valve_closes);
+    return UNITY_END();
+}
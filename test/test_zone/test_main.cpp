@@ -0,0 +1,206 @@
+#include <ArduinoJson.h>
+#include <PicoMQ.h>
+#include <PicoSyslog.h>
+#include <unity.h>
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "mqtt.h"
+#include "zone.h"
+
+PicoSyslog::Logger syslog("calor");
+PicoMQ picomq;
+MQTTServer mqtt;
+
+namespace {
+
+// The decisions Zone::tick made when it still used doubles
+struct ReferenceZone {
+    double desired;
+    double hysteresis;
+    bool heating;
+
+    void tick(double reading) {
+        if (heating) {
+            heating = !(reading >= desired + hysteresis / 2);
+        } else {
+            heating = (reading <= desired - hysteresis / 2);
+        }
+    }
+};
+
+// The same decisions on fixed-point values, the way Zone::tick makes them
+struct FixedZone {
+    int32_t desired_2;
+    int32_t hysteresis;
+    bool heating;
+
+    void tick(int32_t reading) {
+        const int32_t reading_2 = 2 * reading;
+        if (heating) {
+            heating = !(reading_2 >= desired_2 + hysteresis);
+        } else {
+            heating = (reading_2 <= desired_2 - hysteresis);
+        }
+    }
+};
+
+// Average time of a call to tick(i) in nanoseconds
+template <typename F>
+double measure_ns(size_t ticks, F tick) {
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ticks; ++i) {
+        tick(i);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / ticks;
+}
+
+// Zones with the given setpoints and hysteresis values, all reading the same
+// sensor, and their reference counterparts
+struct Grid {
+    std::vector<Zone> zones;
+    std::vector<ReferenceZone> reference;
+
+    Grid(const char * sensor, const std::vector<double> & setpoints,
+         const std::vector<double> & hysteresis_values) {
+        for (double desired : setpoints) {
+            for (double hysteresis : hysteresis_values) {
+                JsonDocument config;
+                config["sensor"] = sensor;
+                config["desired"] = desired;
+                config["hysteresis"] = hysteresis;
+                zones.emplace_back(zones.size(), "zone", config);
+                reference.push_back({desired, hysteresis, false});
+            }
+        }
+    }
+
+    // Feeds the reading to all zones and checks they decide like the
+    // reference
+    void check(const char * sensor, double reading) {
+        char payload[16];
+        snprintf(payload, sizeof(payload), "%.4f", reading);
+        mqtt.deliver(String("celsius/test/") + sensor + "/temperature",
+                     payload);
+        tick_topology(zones);
+
+        for (size_t idx = 0; idx < zones.size(); ++idx) {
+            reference[idx].tick(reading);
+            if (reference[idx].heating !=
+                (zones[idx].get_state() == Zone::State::heat)) {
+                char message[128];
+                snprintf(message, sizeof(message),
+                         "desired %.4f, hysteresis %.4f, reading %s",
+                         reference[idx].desired, reference[idx].hysteresis,
+                         payload);
+                TEST_ASSERT_TRUE_MESSAGE(false, message);
+            }
+        }
+    }
+
+    // Sweeps the reading up and down between the given bounds
+    void sweep(const char * sensor, double low, double high, double step) {
+        for (double reading = low; reading <= high; reading += step) {
+            check(sensor, reading);
+        }
+        for (double reading = high; reading >= low; reading -= step) {
+            check(sensor, reading);
+        }
+    }
+};
+
+}  // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+// DS18B20 readings come in sixteenths of a degree, double arithmetic on them
+// is exact, so the decisions must match exactly, including the boundaries
+void test_hysteresis_sixteenths() {
+    Grid grid("s1", {20.0, 20.5, 21.0, 21.25}, {0, 0.125, 0.25, 0.5, 1.0});
+    grid.sweep("s1", 19.0, 22.5, 1.0 / 16);
+}
+
+// Setpoints, hysteresis and readings in hundredths, compared at values away
+// from the boundaries, where the doubles' rounding doesn't matter
+void test_hysteresis_hundredths() {
+    Grid grid("s2", {20.1, 20.55, 21.3}, {0.1, 0.15, 0.3, 0.75});
+    grid.sweep("s2", 19.0050, 22.5050, 0.01);
+}
+
+void test_boost_validation() {
+    JsonDocument json;
+
+    json["boost"] = 3600;
+    TEST_ASSERT_NULL(Zone::validate_update(json));
+
+    json["boost"] = Zone::max_boost_seconds;
+    TEST_ASSERT_NULL(Zone::validate_update(json));
+
+    json["boost"] = Zone::max_boost_seconds + 1;
+    TEST_ASSERT_NOT_NULL(Zone::validate_update(json));
+
+    json["boost"] = 1e20;
+    TEST_ASSERT_NOT_NULL(Zone::validate_update(json));
+
+    json["boost"] = -1;
+    TEST_ASSERT_NOT_NULL(Zone::validate_update(json));
+}
+
+// Reports the cost of a whole Zone::tick and of the hysteresis decision on
+// doubles and on fixed point, the timings aren't checked.  The host has an
+// FPU, the gain of fixed point is on the ESP8266, where doubles are emulated
+// in software.
+void test_benchmark_tick() {
+    Grid grid("s3", {21.0}, {0.5});
+    grid.check("s3", 20.0);
+
+    // readings around the setpoint, so that both branches are taken
+    std::vector<double> readings;
+    std::vector<int32_t> units;
+    for (int i = 0; i < 64; ++i) {
+        readings.push_back(20.0 + i / 32.0);
+        units.push_back(Temperature::from_double(readings.back()).units());
+    }
+
+    ReferenceZone reference{21.0, 0.5, false};
+    FixedZone fixed{2 * Temperature::from_double(21.0).units(),
+                    Temperature::from_double(0.5).units(), false};
+    size_t reference_heating = 0;
+    size_t fixed_heating = 0;
+
+    const size_t ticks = 1000000;
+    const double zone_ns =
+        measure_ns(ticks, [&grid](size_t) { grid.zones[0].tick(); });
+    const double reference_ns = measure_ns(ticks, [&](size_t i) {
+        reference.tick(readings[i % readings.size()]);
+        reference_heating += reference.heating;
+    });
+    const double fixed_ns = measure_ns(ticks, [&](size_t i) {
+        fixed.tick(units[i % units.size()]);
+        fixed_heating += fixed.heating;
+    });
+
+    // the results are used, so the loops can't be optimized away
+    TEST_ASSERT_EQUAL(reference_heating, fixed_heating);
+
+    char message[128];
+    snprintf(message, sizeof(message),
+             "Zone::tick: %.1f ns, decision on doubles: %.1f ns, "
+             "on fixed point: %.1f ns",
+             zone_ns, reference_ns, fixed_ns);
+    TEST_MESSAGE(message);
+}
+
+int main(int argc, char ** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_hysteresis_sixteenths);
+    RUN_TEST(test_hysteresis_hundredths);
+    RUN_TEST(test_boost_validation);
+    RUN_TEST(test_benchmark_tick);
+    return UNITY_END();
+}
@@ -0,0 +1,308 @@
+#!/usr/bin/env python3
+"""MQTT load test for a Calor node.
+
+Simulates Celsius sensors and Valvola controllers against the broker running
+on a Calor device, and measures what the node sustains at increasing scale.
+
+For the duration of the test, the node is reconfigured with synthetic zones
+(one per simulated valve) through PUT /config/volatile, which applies a config
+without saving it.  The original config is applied again at the end, also when
+the test is interrupted, and a reboot restores it in any case.  Don't run this
+against a node controlling a real boiler.
+
+Each scale step runs a number of sensor publishers on
+celsius/loadtest/<address>/temperature.  The sensors of the synthetic zones
+alternate between cold and warm readings.  Each flip makes Calor send
+schalter/<name>/set, and the simulated valves answer with TON/ON or TOFF/OFF.
+The time from the flipped reading to the valve command is the command latency.
+
+For every step the script reports the message rate sent, the broker's own
+counters from GET /broker, command latency percentiles and free heap.  The
+node reports its longest broker loop per 5 s window, the script polls it during
+the step and reports the longest one seen in the step.
+
+Limits of the node that bound the test: at most 32 zones, and config bodies
+up to 16 KiB, which the synthetic config of 32 zones stays well below.
+
+Requires paho-mqtt (pip install paho-mqtt).  See loadtest.md for the
+measured capacity of a node.
+"""
+
+import argparse
+import json
+import signal
+import threading
+import time
+import urllib.request
+
+import paho.mqtt.client as mqtt
+
+DESIRED = 21.0
+COLD = DESIRED - 2
+WARM = DESIRED + 2
+
+# the node updates its broker counters every 5 s
+POLL_INTERVAL = 5.0
+
+
+def make_client(client_id):
+    try:
+        # paho-mqtt 2.x
+        return mqtt.Client(mqtt.CallbackAPIVersion.VERSION1,
+                           client_id=client_id)
+    except AttributeError:
+        return mqtt.Client(client_id=client_id)
+
+
+class Device:
+    def __init__(self, host, port):
+        self.base = 'http://%s:%d' % (host, port)
+
+    def request(self, method, path, body=None):
+        data = json.dumps(body).encode() if body is not None else None
+        request = urllib.request.Request(self.base + path, data=data,
+                                         method=method)
+        with urllib.request.urlopen(request, timeout=10) as response:
+            return json.load(response)
+
+    def get_config(self):
+        return self.request('GET', '/config')
+
+    def put_volatile_config(self, config):
+        return self.request('PUT', '/config/volatile', config)
+
+    def get_broker(self):
+        return self.request('GET', '/broker')
+
+
+class Valve:
+    """Simulated Valvola controller, reports TON/TOFF right away and ON/OFF
+    after the switch time."""
+
+    def __init__(self, host, port, name, switch_time):
+        self.name = name
+        self.switch_time = switch_time
+        self.state = None
+        self.pending = None  # (expected command, time the reading was sent)
+        self.latencies = []
+        self.lock = threading.Lock()
+
+        self.client = make_client('loadtest-valve-' + name)
+        self.client.on_connect = self.on_connect
+        self.client.on_message = self.on_message
+        self.client.connect(host, port)
+        self.client.loop_start()
+
+    def on_connect(self, client, userdata, flags, rc):
+        client.subscribe('schalter/%s/set' % self.name)
+        client.publish('schalter/' + self.name, 'OFF')
+
+    def on_message(self, client, userdata, message):
+        now = time.monotonic()
+        command = message.payload.decode()
+
+        with self.lock:
+            if self.pending and self.pending[0] == command:
+                self.latencies.append(now - self.pending[1])
+                self.pending = None
+
+        if command == self.state:
+            # periodic repeat of the same command
+            client.publish('schalter/' + self.name,
+                           'ON' if command == 'ON' else 'OFF')
+            return
+
+        self.state = command
+        if command == 'ON':
+            client.publish('schalter/' + self.name, 'TON')
+            threading.Timer(self.switch_time, client.publish,
+                            ('schalter/' + self.name, 'ON')).start()
+        else:
+            client.publish('schalter/' + self.name, 'TOFF')
+            threading.Timer(self.switch_time, client.publish,
+                            ('schalter/' + self.name, 'OFF')).start()
+
+    def expect(self, command, sent):
+        with self.lock:
+            self.pending = (command, sent)
+
+    def stop(self):
+        self.client.loop_stop()
+        self.client.disconnect()
+
+
+class Sensor:
+    """Simulated Celsius sensor."""
+
+    def __init__(self, host, port, address):
+        self.topic = 'celsius/loadtest/%s/temperature' % address
+        self.value = DESIRED
+        self.sent = 0
+        self.client = make_client('loadtest-sensor-' + address)
+        self.client.connect(host, port)
+        self.client.loop_start()
+
+    def publish(self, value=None):
+        if value is not None:
+            self.value = value
+        self.client.publish(self.topic, '%.2f' % self.value)
+        self.sent += 1
+        return time.monotonic()
+
+    def stop(self):
+        self.client.loop_stop()
+        self.client.disconnect()
+
+
+def sensor_address(index):
+    return 'ff%014x' % index
+
+
+def percentile(values, p):
+    if not values:
+        return float('nan')
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def run_step(args, device, sensor_count, valves):
+    # every zone needs a sensor, steps below the valve count run more
+    sensor_count = max(sensor_count, len(valves))
+    sensors = [Sensor(args.host, args.mqtt_port, sensor_address(i))
+               for i in range(sensor_count)]
+    zone_sensors = sensors[:len(valves)]
+
+    for valve in valves:
+        valve.latencies = []
+
+    start = time.monotonic()
+    interval = 1.0 / args.rate
+    next_publish = start
+    next_flip = start + args.flip_interval
+    cold = False
+
+    before = device.get_broker()
+    max_loop_us = 0
+    next_poll = start + POLL_INTERVAL
+
+    while time.monotonic() - start < args.duration:
+        now = time.monotonic()
+
+        if now >= next_flip:
+            cold = not cold
+            for sensor, valve in zip(zone_sensors, valves):
+                sent = sensor.publish(COLD if cold else WARM)
+                valve.expect('ON' if cold else 'OFF', sent)
+            next_flip += args.flip_interval
+
+        if now >= next_publish:
+            for sensor in sensors:
+                sensor.publish()
+            next_publish += interval
+
+        if now >= next_poll:
+            max_loop_us = max(max_loop_us,
+                              device.get_broker().get('max_loop_us', 0))
+            next_poll += POLL_INTERVAL
+
+        delay = min(next_publish, next_flip, next_poll) - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+
+    elapsed = time.monotonic() - start
+    after = device.get_broker()
+    max_loop_us = max(max_loop_us, after.get('max_loop_us', 0))
+
+    for sensor in sensors:
+        sensor.stop()
+
+    latencies = [l * 1000 for valve in valves for l in valve.latencies]
+    return {
+        'sensors': sensor_count,
+        'sent_per_second': sum(s.sent for s in sensors) / elapsed,
+        'broker_in_per_second':
+            (after['messages_in'] - before['messages_in']) / elapsed,
+        'broker_out_per_second':
+            (after['messages_out'] - before['messages_out']) / elapsed,
+        'max_loop_us': max_loop_us,
+        'free_heap': after.get('free_heap'),
+        'commands': len(latencies),
+        'latency_p50': percentile(latencies, 50),
+        'latency_p90': percentile(latencies, 90),
+        'latency_p99': percentile(latencies, 99),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__.split('\n\n')[0],
+        epilog='Run this against a test node only, see the module docstring.')
+    parser.add_argument('host', help='Calor node')
+    parser.add_argument('--mqtt-port', type=int, default=1883)
+    parser.add_argument('--http-port', type=int, default=80)
+    parser.add_argument('--steps', default='1,2,4,8,16,32,64',
+                        help='comma separated sensor counts')
+    parser.add_argument('--valves', type=int, default=4,
+                        help='number of valves and synthetic zones (max 32)')
+    parser.add_argument('--rate', type=float, default=1.0,
+                        help='readings per second per sensor')
+    parser.add_argument('--switch-time', type=float, default=0.0,
+                        help='simulated valve switch time in seconds')
+    parser.add_argument('--flip-interval', type=float, default=5.0,
+                        help='seconds between cold and warm readings')
+    parser.add_argument('--duration', type=float, default=30.0,
+                        help='seconds per step')
+    args = parser.parse_args()
+
+    steps = [int(step) for step in args.steps.split(',')]
+    valve_count = min(args.valves, 32)
+
+    device = Device(args.host, args.http_port)
+    original_config = device.get_config()
+
+    config = json.loads(json.dumps(original_config))
+    # keep the synthetic zones out of Home Assistant
+    config.pop('hass', None)
+    config['zones'] = {
+        'loadtest-%d' % i: {
+            'desired': DESIRED,
+            'hysteresis': 0.5,
+            'sensor': sensor_address(i),
+            'valve': 'loadtest-%d' % i,
+        }
+        for i in range(valve_count)
+    }
+
+    def terminate(signum, frame):
+        raise KeyboardInterrupt
+
+    # restore the original config when killed as well
+    signal.signal(signal.SIGTERM, terminate)
+
+    valves = []
+    try:
+        device.put_volatile_config(config)
+        valves = [Valve(args.host, args.mqtt_port, 'loadtest-%d' % i,
+                        args.switch_time) for i in range(valve_count)]
+
+        print('%8s %10s %10s %10s %10s %10s %10s %10s %10s %10s' % (
+            'sensors', 'sent/s', 'in/s', 'out/s', 'loop us', 'p50 ms',
+            'p90 ms', 'p99 ms', 'commands', 'heap'))
+        for sensor_count in steps:
+            result = run_step(args, device, sensor_count, valves)
+            print('%8d %10.1f %10.1f %10.1f %10d %10.1f %10.1f %10.1f '
+                  '%10d %10s' % (
+                      result['sensors'], result['sent_per_second'],
+                      result['broker_in_per_second'],
+                      result['broker_out_per_second'],
+                      result['max_loop_us'], result['latency_p50'],
+                      result['latency_p90'], result['latency_p99'],
+                      result['commands'], result['free_heap']), flush=True)
+    finally:
+        for valve in valves:
+            valve.stop()
+        device.put_volatile_config(original_config)
+
+
+if __name__ == '__main__':
+    main()